@@ -0,0 +1,70 @@
+#ifndef BENCH_BINS_H
+#define BENCH_BINS_H
+
+#include "bench_utils.h"
+#include "heap_config.h"
+
+#define BINS_MAX_HOLES 100000
+#define BINS_SAMPLES 4096
+#define BINS_HOLE_BYTES (HEAP_TCACHE_MAX_BYTES + 64) /* past pools and caches */
+#define BINS_REQUEST_BYTES (BINS_HOLE_BYTES + 1024)  /* fits no hole */
+
+/*
+ * Fragment the heap into [hole][separator] pairs, free a growing number of
+ * holes, and time allocations that none of the holes can satisfy. A linear
+ * free-list scan walks every hole; the binned lookup should stay flat.
+ */
+static void bench_bins_latency(void) {
+  LOG_BENCH("halloc latency vs free-block count");
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+
+  static void* holes[BINS_MAX_HOLES];
+  static uint64_t samples[BINS_SAMPLES];
+  size_t pairs = 0;
+
+  /* keep room for the timed allocations once the heap is carved up */
+  void* reserve = halloc(16 * 1024);
+
+  /* sizes rotate so the spray detector does not trip */
+  for (; pairs < BINS_MAX_HOLES; pairs++) {
+    void* hole = halloc(BINS_HOLE_BYTES + pairs % 8 * 16);
+    void* sep = halloc(BINS_HOLE_BYTES + (pairs + 3) % 8 * 16);
+    if (!hole || !sep) break;
+    holes[pairs] = hole;
+  }
+  hfree(reserve);
+
+  size_t freed = 0;
+  for (size_t target = 10; target <= BINS_MAX_HOLES; target *= 10) {
+    if (target > pairs) {
+      printf("free blocks=%6zu  skipped (heap holds %zu pairs)\n", target,
+             pairs);
+      continue;
+    }
+    for (; freed < target; freed++) hfree(holes[freed]);
+
+    for (size_t i = 0; i < BINS_SAMPLES; i++) {
+      uint64_t t0 = bench_now_ns();
+      void* p = halloc(BINS_REQUEST_BYTES + i % 8);
+      uint64_t t1 = bench_now_ns();
+      if (!p) {
+        printf("allocation failed: %s\n",
+               heap_error_what(heap_last_error()));
+        return;
+      }
+      hfree(p);
+      samples[i] = t1 - t0;
+    }
+
+    uint64_t p50 = bench_percentile(samples, BINS_SAMPLES, 50);
+    uint64_t p99 = bench_percentile(samples, BINS_SAMPLES, 99);
+    printf("free blocks=%6zu  p50=%6llu ns  p99=%6llu ns\n", target,
+           (unsigned long long)p50, (unsigned long long)p99);
+  }
+}
+
+#endif /* BENCH_BINS_H */
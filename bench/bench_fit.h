@@ -0,0 +1,86 @@
+#ifndef BENCH_FIT_H
+#define BENCH_FIT_H
+
+#include "bench_utils.h"
+#include "heap_config.h"
+
+#define FIT_SLOTS 2048
+#define FIT_OPS 400000
+
+/* xorshift32: the same seed replays the same trace on every build */
+static uint32_t fit_next(uint32_t* s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 17;
+  *s ^= *s << 5;
+  return *s;
+}
+
+/*
+ * Replay an alloc/free trace whose sizes span 32 B to 64 KB and report
+ * throughput, peak mapped vs peak live bytes, and how scattered the free
+ * space is afterwards. Build with -DHEAP_TREE_MIN_BYTES=0 for the bins-only
+ * baseline (make clean && make bench EXTRA_CFLAGS=-DHEAP_TREE_MIN_BYTES=0).
+ */
+static void bench_fit(void) {
+  static void* slot[FIT_SLOTS];
+  static size_t slot_size[FIT_SLOTS];
+
+  LOG_BENCH("placement policy on a mixed-size trace");
+  printf("size tree from %u bytes (0 = bins only)\n",
+         (unsigned)HEAP_TREE_MIN_BYTES);
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+
+  uint32_t seed = 0x2545F491u;
+  size_t live = 0, peak_live = 0, peak_mapped = 0;
+  uint64_t t0 = bench_now_ns();
+  for (int i = 0; i < FIT_OPS; i++) {
+    size_t k = fit_next(&seed) % FIT_SLOTS;
+    if (slot[k]) {
+      hfree(slot[k]);
+      live -= slot_size[k];
+      slot[k] = NULL;
+      continue;
+    }
+
+    /* log-uniform sizes: pick a power of two, then a point inside it */
+    size_t base = (size_t)32 << (fit_next(&seed) % 12);
+    size_t size = base + fit_next(&seed) % base;
+    slot[k] = halloc_uninit(size);
+    if (!slot[k]) {
+      printf("allocation failed: %s\n", heap_error_what(heap_last_error()));
+      return;
+    }
+    slot_size[k] = size;
+    live += size;
+    if (live > peak_live) peak_live = live;
+    if (heap_total_size() > peak_mapped) peak_mapped = heap_total_size();
+  }
+  uint64_t t1 = bench_now_ns();
+
+  /* free space left between the survivors */
+  size_t free_bytes = 0, largest = 0;
+  heap_lock();
+  for (Header* bp = heap_first_block(); bp; bp = heap_next_block(bp)) {
+    if (IS_INUSE(bp)) continue;
+    free_bytes += BLOCK_BYTES(bp);
+    if (BLOCK_BYTES(bp) > largest) largest = BLOCK_BYTES(bp);
+  }
+  heap_unlock();
+
+  printf("throughput      %10.1f ns/op\n", (double)(t1 - t0) / FIT_OPS);
+  printf("peak mapped     %10zu KB for %zu KB peak live (%.2fx)\n",
+         peak_mapped / 1024, peak_live / 1024,
+         (double)peak_mapped / (double)peak_live);
+  printf("free at end     %10zu KB, largest block %zu KB (%.1f%% scattered)\n",
+         free_bytes / 1024, largest / 1024,
+         free_bytes ? 100.0 * (double)(free_bytes - largest) / free_bytes : 0);
+
+  for (size_t k = 0; k < FIT_SLOTS; k++)
+    if (slot[k]) hfree(slot[k]);
+}
+
+#endif /* BENCH_FIT_H */
@@ -0,0 +1,73 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench_bins.h"
+#include "bench_fit.h"
+#include "bench_overhead.h"
+#include "bench_pool.h"
+#include "bench_preload.h"
+#include "bench_region.h"
+#include "bench_threads.h"
+#include "bench_zero.h"
+
+/* Benchmark runner entry point */
+int main() {
+  int choice = 0;
+
+  /* Print benchmark menu */
+  printf("Heap Allocator Benchmark Menu:\n");
+  printf("1. halloc latency vs free-block count\n");
+  printf("2. multi-threaded halloc/hfree throughput\n");
+  printf("3. zeroing and poisoning cost\n");
+  printf("4. memory overhead per small object\n");
+  printf("5. placement policy on a mixed-size trace\n");
+  printf("6. region vs halloc/hfree for request-scoped objects\n");
+  printf("7. unmodified programs on glibc vs LD_PRELOAD bualloc\n");
+  printf("8. pool free stack vs mutex under contention\n");
+  printf("9. pool producer/consumer with remote frees\n");
+  printf("Enter benchmark number to run: ");
+
+  if (scanf("%d", &choice) != 1) {
+    fprintf(stderr, "Invalid input.\n");
+    return 1;
+  }
+
+  /* Dispatch selected benchmark */
+  switch (choice) {
+    case 1:
+      bench_bins_latency();
+      break;
+    case 2:
+      bench_threads_scaling();
+      break;
+    case 3:
+      bench_zeroing();
+      break;
+    case 4:
+      bench_overhead();
+      break;
+    case 5:
+      bench_fit();
+      break;
+    case 6:
+      bench_region();
+      break;
+    case 7:
+      bench_preload();
+      break;
+    case 8:
+      bench_pool_contention();
+      break;
+    case 9:
+      bench_pool_handoff();
+      break;
+    default:
+      printf("Invalid choice.\n");
+      return 1;
+  }
+
+  printf("Benchmark finished.\n");
+  return 0;
+}
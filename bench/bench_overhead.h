@@ -0,0 +1,56 @@
+#ifndef BENCH_OVERHEAD_H
+#define BENCH_OVERHEAD_H
+
+#include "bench_utils.h"
+#include "heap_config.h"
+#include "heap_pool.h"
+
+#define OVERHEAD_OBJECTS 10000
+
+/* Block bytes held by callers across all arenas and pools */
+static size_t bench_bytes_in_use(void) {
+  HeapArenaStats st;
+  PoolStats pools;
+  size_t bytes = 0;
+  for (unsigned a = 0; a < heap_arena_count(); a++)
+    if (heap_arena_stats(a, &st) == HEAP_SUCCESS) bytes += st.bytes_in_use;
+  if (pool_get_stats(&pools) == HEAP_SUCCESS) bytes += pools.used_bytes;
+  return bytes;
+}
+
+/*
+ * Heap bytes spent per live object of a given size: header, fences and
+ * rounding, or the pool class's rounding for the sizes the pools serve. Run
+ * it under each hardening profile (make bench-profiles).
+ */
+static void bench_overhead(void) {
+  static const size_t sizes[] = {16, 24, 32, 48, 64, 128, 256};
+  static void* objs[OVERHEAD_OBJECTS];
+
+  LOG_BENCH("memory overhead per small object");
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+  printf("header=%zu bytes, fences=%d bytes\n", HEADER_SIZE_BYTES,
+         2 * FENCE_SIZE);
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    size_t before = bench_bytes_in_use();
+    size_t n = 0;
+
+    /* shave a few bytes off in rotation so the spray detector stays quiet */
+    for (; n < OVERHEAD_OBJECTS; n++) {
+      objs[n] = halloc(sizes[s] - n % 8);
+      if (!objs[n]) break;
+    }
+    double per_obj = n ? (double)(bench_bytes_in_use() - before) / n : 0;
+    printf("object=%4zu bytes  heap=%7.1f bytes/object  overhead=%6.1f%%\n",
+           sizes[s], per_obj, 100.0 * (per_obj - sizes[s]) / sizes[s]);
+
+    while (n) hfree(objs[--n]);
+  }
+}
+
+#endif /* BENCH_OVERHEAD_H */
@@ -0,0 +1,170 @@
+#ifndef BENCH_POOL_H
+#define BENCH_POOL_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_utils.h"
+#include "heap_pool.h"
+
+#define POOL_BENCH_OPS 500000
+#define POOL_BENCH_LIVE 16
+#define POOL_BENCH_MAX 64
+
+/* Baseline: the same pool calls, serialized by one mutex */
+static pthread_mutex_t pool_bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pool_bench_locked;
+
+static void* pool_bench_alloc(size_t size) {
+  if (!pool_bench_locked) return pool_alloc(size);
+  pthread_mutex_lock(&pool_bench_lock);
+  void* p = pool_alloc(size);
+  pthread_mutex_unlock(&pool_bench_lock);
+  return p;
+}
+
+static void pool_bench_free(void* p) {
+  if (!pool_bench_locked) {
+    pool_free(p);
+    return;
+  }
+  pthread_mutex_lock(&pool_bench_lock);
+  pool_free(p);
+  pthread_mutex_unlock(&pool_bench_lock);
+}
+
+/* Every thread cycles a few blocks of one class: all hit the same pool */
+static void* pool_bench_worker(void* arg) {
+  (void)arg;
+  void* live[POOL_BENCH_LIVE] = {0};
+
+  for (int i = 0; i < POOL_BENCH_OPS; i++) {
+    int slot = i % POOL_BENCH_LIVE;
+    if (live[slot]) pool_bench_free(live[slot]);
+    live[slot] = pool_bench_alloc(40);
+  }
+
+  for (int s = 0; s < POOL_BENCH_LIVE; s++)
+    if (live[s]) pool_bench_free(live[s]);
+  return NULL;
+}
+
+static double pool_bench_run(int n) {
+  pthread_t threads[POOL_BENCH_MAX];
+
+  uint64_t t0 = bench_now_ns();
+  for (int i = 0; i < n; i++)
+    pthread_create(&threads[i], NULL, pool_bench_worker, NULL);
+  for (int i = 0; i < n; i++) pthread_join(threads[i], NULL);
+  uint64_t elapsed = bench_now_ns() - t0;
+
+  return (double)n * POOL_BENCH_OPS * 1e3 / (double)elapsed;
+}
+
+/*
+ * Contended pool_alloc/pool_free on one size class: the lock-free free stack
+ * against the same calls behind a mutex, for 1..N threads (N at least 4).
+ */
+static void bench_pool_contention(void) {
+  LOG_BENCH("pool free stack vs mutex under contention");
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = online > 4 ? (int)online : 4;
+  if (max_threads > POOL_BENCH_MAX) max_threads = POOL_BENCH_MAX;
+  printf("online cpus=%ld\n", online);
+
+  for (int n = 1;; n *= 2) {
+    if (n > max_threads) n = max_threads;
+
+    pool_bench_locked = 0;
+    double lock_free = pool_bench_run(n);
+    pool_bench_locked = 1;
+    double mutex = pool_bench_run(n);
+
+    printf("threads=%3d  lock-free %8.2f Mops/s  mutex %8.2f Mops/s", n,
+           lock_free, mutex);
+    printf("  (x%.2f)\n", lock_free / mutex);
+
+    if (n == max_threads) break;
+  }
+}
+
+#define HANDOFF_BENCH_MSGS 500000
+#define HANDOFF_BENCH_RING 1024  /* power of two */
+#define HANDOFF_BENCH_PAIRS 8
+
+/* One producer/consumer pair: a single-producer single-consumer ring */
+typedef struct {
+  void* slot[HANDOFF_BENCH_RING];
+  size_t head;  /* written by the consumer */
+  size_t tail;  /* written by the producer */
+} handoff_ring;
+
+/* Allocate messages and pass them on: the consumer frees every one */
+static void* handoff_producer(void* arg) {
+  handoff_ring* r = (handoff_ring*)arg;
+  for (size_t i = 0; i < HANDOFF_BENCH_MSGS; i++) {
+    size_t* msg = (size_t*)pool_alloc(24 + i % 40);
+    if (!msg) abort();
+    msg[0] = i;
+    while (i - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >=
+           HANDOFF_BENCH_RING)
+      sched_yield();
+    r->slot[i % HANDOFF_BENCH_RING] = msg;
+    __atomic_store_n(&r->tail, i + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void* handoff_consumer(void* arg) {
+  handoff_ring* r = (handoff_ring*)arg;
+  for (size_t i = 0; i < HANDOFF_BENCH_MSGS; i++) {
+    while (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == i) sched_yield();
+    size_t* msg = (size_t*)r->slot[i % HANDOFF_BENCH_RING];
+    if (msg[0] != i) abort();
+    pool_free(msg);
+    __atomic_store_n(&r->head, i + 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+/*
+ * Producer/consumer pipelines: every message is allocated by one thread and
+ * freed by another, so each free goes through the producer's remote queue.
+ */
+static void bench_pool_handoff(void) {
+  static handoff_ring rings[HANDOFF_BENCH_PAIRS];
+
+  LOG_BENCH("pool producer/consumer with remote frees");
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+
+  for (int pairs = 1; pairs <= HANDOFF_BENCH_PAIRS; pairs *= 2) {
+    pthread_t threads[2 * HANDOFF_BENCH_PAIRS];
+    memset(rings, 0, sizeof(rings));
+
+    uint64_t t0 = bench_now_ns();
+    for (int p = 0; p < pairs; p++) {
+      pthread_create(&threads[2 * p], NULL, handoff_producer, &rings[p]);
+      pthread_create(&threads[2 * p + 1], NULL, handoff_consumer, &rings[p]);
+    }
+    for (int t = 0; t < 2 * pairs; t++) pthread_join(threads[t], NULL);
+    uint64_t elapsed = bench_now_ns() - t0;
+
+    double msgs = (double)pairs * HANDOFF_BENCH_MSGS;
+    printf("pairs=%2d  %8.2f M msgs/s  (%6.1f ns per message)\n", pairs,
+           msgs * 1e3 / (double)elapsed, (double)elapsed / msgs);
+  }
+}
+
+#endif /* BENCH_POOL_H */
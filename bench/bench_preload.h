@@ -0,0 +1,72 @@
+#ifndef BENCH_PRELOAD_H
+#define BENCH_PRELOAD_H
+
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_utils.h"
+
+#define PRELOAD_LIB "bin/libbualloc.so"
+
+/* Unmodified programs that allocate a lot */
+static const char* const preload_cmds[] = {
+    "seq 1 2000000 | sort -r | sort -n > /dev/null",
+    "seq 1 500000 | awk '{ a[$1] = $1 \"x\" } END { print length(a) }' "
+    "> /dev/null",
+};
+
+/* Run cmd under sh, with lib preloaded unless NULL; 0 on success */
+static int preload_run(const char* cmd, const char* lib, double* ms,
+                       long* rss_kb) {
+  uint64_t t0 = bench_now_ns();
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    if (lib)
+      setenv("LD_PRELOAD", lib, 1);
+    else
+      unsetenv("LD_PRELOAD");
+    execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage ru;
+  if (wait4(pid, &status, 0, &ru) < 0) return -1;
+  *ms = (double)(bench_now_ns() - t0) / 1e6;
+  *rss_kb = ru.ru_maxrss;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/* Wall time and peak RSS of the same programs on glibc and on bualloc */
+static void bench_preload(void) {
+  LOG_BENCH("unmodified programs: glibc malloc vs LD_PRELOAD bualloc");
+
+  char* lib = realpath(PRELOAD_LIB, NULL);
+  if (!lib || access(lib, R_OK) != 0) {
+    printf("%s not found, build it with `make lib`\n", PRELOAD_LIB);
+    free(lib);
+    return;
+  }
+
+  printf("%-8s %10s %10s   command\n", "heap", "ms", "peak KB");
+  for (size_t c = 0; c < sizeof(preload_cmds) / sizeof(preload_cmds[0]);
+       c++) {
+    for (int use = 0; use < 2; use++) {
+      double ms;
+      long rss;
+      if (preload_run(preload_cmds[c], use ? lib : NULL, &ms, &rss) != 0) {
+        printf("%-8s failed: %s\n", use ? "bualloc" : "glibc",
+               preload_cmds[c]);
+        continue;
+      }
+      printf("%-8s %10.1f %10ld   %s\n", use ? "bualloc" : "glibc", ms, rss,
+             preload_cmds[c]);
+    }
+  }
+  free(lib);
+}
+
+#endif /* BENCH_PRELOAD_H */
@@ -0,0 +1,69 @@
+#ifndef BENCH_REGION_H
+#define BENCH_REGION_H
+
+#include "bench_utils.h"
+#include "heap_region.h"
+
+#define REGION_BENCH_REQUESTS 2000
+#define REGION_BENCH_OBJECTS 256
+
+/* Object size i of a request: 10 sizes of 16-232 bytes, spray detector quiet */
+static size_t region_bench_size(int i) { return 16 + (size_t)(i * 24) % 240; }
+
+/*
+ * A request-scoped workload: every request allocates a few hundred small
+ * objects, touches them, and drops them all at the end.
+ */
+static void bench_region(void) {
+  static void* obj[REGION_BENCH_OBJECTS];
+
+  LOG_BENCH("region vs halloc/hfree for request-scoped objects");
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+
+  uint64_t t0 = bench_now_ns();
+  for (int r = 0; r < REGION_BENCH_REQUESTS; r++) {
+    for (int i = 0; i < REGION_BENCH_OBJECTS; i++) {
+      obj[i] = halloc(region_bench_size(i));
+      if (!obj[i]) {
+        printf("halloc failed: %s\n", heap_error_what(heap_last_error()));
+        return;
+      }
+      *(int*)obj[i] = i;
+    }
+    for (int i = 0; i < REGION_BENCH_OBJECTS; i++) hfree(obj[i]);
+  }
+  uint64_t t1 = bench_now_ns();
+
+  HeapRegion* region = harena_create(0);
+  if (!region) {
+    printf("harena_create failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+  uint64_t t2 = bench_now_ns();
+  for (int r = 0; r < REGION_BENCH_REQUESTS; r++) {
+    for (int i = 0; i < REGION_BENCH_OBJECTS; i++) {
+      obj[i] = harena_alloc(region, region_bench_size(i));
+      if (!obj[i]) {
+        printf("harena_alloc failed: %s\n",
+               heap_error_what(heap_last_error()));
+        return;
+      }
+      *(int*)obj[i] = i;
+    }
+    harena_reset(region);
+  }
+  uint64_t t3 = bench_now_ns();
+  harena_destroy(region);
+
+  double n = (double)REGION_BENCH_REQUESTS * REGION_BENCH_OBJECTS;
+  printf("%d requests of %d objects\n", REGION_BENCH_REQUESTS,
+         REGION_BENCH_OBJECTS);
+  printf("halloc + hfree          %8.1f ns/object\n", (double)(t1 - t0) / n);
+  printf("harena_alloc + reset    %8.1f ns/object\n", (double)(t3 - t2) / n);
+}
+
+#endif /* BENCH_REGION_H */
@@ -0,0 +1,67 @@
+#ifndef BENCH_THREADS_H
+#define BENCH_THREADS_H
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bench_utils.h"
+
+#define THREADS_BENCH_OPS 200000
+#define THREADS_BENCH_LIVE 64
+#define THREADS_BENCH_MAX 64
+
+/* Replace random slots of a small working set with fresh allocations */
+static void* bench_threads_worker(void* arg) {
+  uint32_t seed = 0x2545F491u * (uint32_t)(uintptr_t)arg + 1;
+  void* live[THREADS_BENCH_LIVE] = {0};
+
+  for (int i = 0; i < THREADS_BENCH_OPS; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int slot = (int)(seed % THREADS_BENCH_LIVE);
+    if (live[slot]) hfree(live[slot]);
+    live[slot] = halloc(16 + (seed >> 8) % 512);
+  }
+
+  for (int s = 0; s < THREADS_BENCH_LIVE; s++)
+    if (live[s]) hfree(live[s]);
+  return NULL;
+}
+
+/* Aggregate alloc+free throughput for 1..N threads (N = online CPUs) */
+static void bench_threads_scaling(void) {
+  LOG_BENCH("multi-threaded halloc/hfree throughput");
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = online > 0 ? (int)online : 1;
+  if (max_threads > THREADS_BENCH_MAX) max_threads = THREADS_BENCH_MAX;
+  printf("online cpus=%d\n", max_threads);
+
+  pthread_t threads[THREADS_BENCH_MAX];
+
+  for (int n = 1;; n *= 2) {
+    if (n > max_threads) n = max_threads;
+
+    uint64_t t0 = bench_now_ns();
+    for (int i = 0; i < n; i++)
+      pthread_create(&threads[i], NULL, bench_threads_worker,
+                     (void*)(uintptr_t)(i + 1));
+    for (int i = 0; i < n; i++) pthread_join(threads[i], NULL);
+    uint64_t elapsed = bench_now_ns() - t0;
+
+    double ops = (double)n * THREADS_BENCH_OPS;
+    printf("threads=%3d  %8.2f Mops/s  (%6.2f Mops/s per thread)\n", n,
+           ops * 1e3 / (double)elapsed, ops * 1e3 / (double)elapsed / n);
+
+    if (n == max_threads) break;
+  }
+}
+
+#endif /* BENCH_THREADS_H */
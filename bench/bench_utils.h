@@ -0,0 +1,40 @@
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "heap.h"
+#include "heap_errors.h"
+
+/* Log benchmark banner */
+#define LOG_BENCH(msg)           \
+  do {                           \
+    printf("[BENCH] %s\n", msg); \
+  } while (0)
+
+/* Current monotonic time in nanoseconds */
+static inline uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int bench_cmp_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+/* Sort samples in place and return the requested percentile (0-100) */
+static inline uint64_t bench_percentile(uint64_t* samples, size_t n,
+                                        unsigned pct) {
+  if (n == 0) return 0;
+  qsort(samples, n, sizeof(samples[0]), bench_cmp_u64);
+  size_t idx = (n * pct) / 100;
+  return samples[idx < n ? idx : n - 1];
+}
+
+#endif /* BENCH_UTILS_H */
@@ -0,0 +1,46 @@
+#ifndef BENCH_ZERO_H
+#define BENCH_ZERO_H
+
+#include <string.h>
+
+#include "bench_utils.h"
+
+#define ZERO_BENCH_ROUNDS 2000
+#define ZERO_BENCH_BYTES (60 * 1024)  /* below the direct-mmap threshold */
+
+/* Allocate, overwrite and free a large buffer; ns per round trip */
+static double bench_zero_run(void* (*alloc)(size_t)) {
+  uint64_t t0 = bench_now_ns();
+  for (int i = 0; i < ZERO_BENCH_ROUNDS; i++) {
+    /* vary the size so the spray detector stays quiet */
+    size_t size = ZERO_BENCH_BYTES + (size_t)(i % 64) * 32;
+    unsigned char* p = (unsigned char*)alloc(size);
+    if (!p) {
+      printf("allocation failed: %s\n", heap_error_what(heap_last_error()));
+      return 0;
+    }
+    memset(p, i & 0xFF, size);
+    hfree(p);
+  }
+  return (double)(bench_now_ns() - t0) / ZERO_BENCH_ROUNDS;
+}
+
+/* Cost of zeroing on allocation and poisoning on free */
+static void bench_zeroing(void) {
+  LOG_BENCH("zeroing and poisoning cost for 60 KB buffers");
+
+  if (hinit(MAX_HEAP_SIZE) != HEAP_SUCCESS) {
+    printf("hinit failed: %s\n", heap_error_what(heap_last_error()));
+    return;
+  }
+
+  printf("halloc        + poison     %10.0f ns/op\n", bench_zero_run(halloc));
+  printf("halloc_uninit + poison     %10.0f ns/op\n",
+         bench_zero_run(halloc_uninit));
+  heap_set_poison(0);
+  printf("halloc_uninit, no poison   %10.0f ns/op\n",
+         bench_zero_run(halloc_uninit));
+  heap_set_poison(1);
+}
+
+#endif /* BENCH_ZERO_H */
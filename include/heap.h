@@ -6,10 +6,47 @@
 #include "heap_errors.h"
 #include "heap_internal.h" 
 
+/* Heap setup: zero fields pick the defaults */
+typedef struct {
+  size_t initial_bytes;   /* first segment, 0 = DEFAULT_HEAP_SIZE */
+  unsigned arenas;        /* 0 = one per online CPU */
+  size_t mmap_threshold;  /* direct-mmap cutoff, 0 = HEAP_MMAP_THRESHOLD */
+  unsigned decay_ms;      /* free time before pages are released,
+                             0 = HEAP_SCAVENGE_DECAY_MS */
+  unsigned scavenge_ms;   /* background scavenger period, 0 = no thread */
+  int huge_pages;         /* back segments and pools with huge pages */
+} HeapConfig;
+
+/* A heap instance; NULL stands for the default heap wherever one is taken */
+typedef struct Heap Heap;
+
 /* Allocation interface */
 void* halloc(size_t size);
 void hfree(void* ptr);
+void hfree_sized(void* ptr, size_t size);
+void* hrealloc(void* ptr, size_t size);
+void* hcalloc(size_t count, size_t size);
+void* halloc_uninit(size_t size);
+void* haligned_alloc(size_t alignment, size_t size);
+int hposix_memalign(void** memptr, size_t alignment, size_t size);
 HeapErrorCode hinit(size_t initial_bytes);
+HeapErrorCode hinit_config(const HeapConfig* cfg);
+
+/* n same-sized blocks at once: all n or none; hfree_batch sorts ptrs */
+size_t halloc_batch(size_t size, size_t n, void** out);
+void hfree_batch(void** ptrs, size_t n);
+
+/*
+ * Use-after-free poisoning of freed payloads (default HEAP_POISON_FREE).
+ * No effect below HEAP_HARDEN_FULL, where poisoning is compiled out.
+ */
+void heap_set_poison(int enabled);
+
+/* Bytes the caller may use at ptr (at least the size asked for) */
+size_t heap_usable_size(void* ptr);
+
+/* Give the pages of blocks free for decay_ms or longer back to the OS */
+size_t heap_scavenge(unsigned decay_ms);
 
 /* Diagnostics */
 HeapErrorCode heap_last_error(void);
@@ -22,5 +59,75 @@ size_t heap_total_size(void);
 Header* heap_first_block(void);
 Header* heap_next_block(Header* current);
 
+/* Hold the heap lock across a traversal (recursive, no-op if single-threaded) */
+void heap_lock(void);
+void heap_unlock(void);
+
+/* The same for one heap (NULL = default); heap_next_block stays within it */
+Header* heap_first_block_in(Heap* h);
+void heap_lock_in(Heap* h);
+void heap_unlock_in(Heap* h);
+
+/* Heap a heap address belongs to: its instance, NULL for the default heap */
+Heap* heap_owner_of(const void* ptr);
+
+/* Per-arena counters */
+typedef struct {
+  size_t mapped_bytes;    /* bytes mapped by the arena's segments */
+  size_t segments;        /* segments mapped */
+  size_t allocs;          /* blocks carved out of the bins */
+  size_t frees;           /* blocks returned to the bins */
+  size_t bytes_in_use;    /* block bytes held by callers and thread caches */
+  size_t peak_in_use;     /* max bytes_in_use */
+  size_t free_bytes;      /* bytes in free blocks (bins and size tree) */
+  size_t free_blocks;     /* free blocks */
+  size_t largest_free;    /* largest free block, bytes */
+  size_t lock_contended;  /* lock acquisitions that had to wait */
+  size_t threads;         /* threads currently assigned */
+  size_t scavenged_bytes; /* bytes given back to the OS by the scavenger */
+  size_t hugetlb_bytes;   /* segment bytes on reserved huge pages */
+  size_t thp_bytes;       /* segment bytes advised for transparent huge pages */
+} HeapArenaStats;
+
+unsigned heap_arena_count(void);
+HeapErrorCode heap_arena_stats(unsigned idx, HeapArenaStats* out);
+void heap_arena_print_stats(void);
+
+/*
+ * Heap instances: private heaps with their own segments, pools, GC roots and
+ * counters. Instances need no hinit and take all of cfg but the arena count
+ * and mmap threshold (they have one arena and no direct mappings). Their
+ * blocks go back through heap_free; heap_destroy unmaps them all at once.
+ */
+Heap* heap_create(const HeapConfig* cfg);
+void* heap_alloc(Heap* h, size_t size);
+void heap_free(Heap* h, void* ptr);
+void heap_destroy(Heap* h);
+
+/* An instance's counters; NULL sums the default heap's arenas */
+HeapErrorCode heap_instance_stats(Heap* h, HeapArenaStats* out);
+
+/*
+ * The default heap at a glance, cheap enough to poll: every count is kept up
+ * to date by the allocator and read in O(1), one arena lock at a time.
+ * largest_free is exact unless the top block sits in a ranged bin below the
+ * size tree; that bin's largest size since it last emptied is reported.
+ */
+typedef struct {
+  size_t bytes_in_use;    /* arena block bytes held by callers and caches */
+  size_t peak_in_use;     /* max bytes_in_use, over all arenas at once */
+  size_t free_bytes;      /* bytes in the arenas' free blocks */
+  size_t free_blocks;     /* free blocks */
+  size_t largest_free;    /* largest free block in any arena, bytes */
+  double fragmentation;   /* 1 - largest_free / free_bytes, 0 if none free */
+  size_t mapped_bytes;    /* arena segments */
+  size_t direct_blocks;   /* blocks with a mapping of their own */
+  size_t direct_bytes;    /* bytes mapped for them */
+  size_t allocs;          /* arena blocks handed out */
+  size_t frees;           /* arena blocks returned */
+} HeapStats;
+
+HeapErrorCode heap_get_stats(HeapStats* out);
+
 
 #endif /* HEAP_H */
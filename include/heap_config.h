@@ -6,7 +6,98 @@
 #define DEFAULT_HEAP_SIZE (64u * 1024u)              /* 64 KB */
 #define MAX_HEAP_SIZE     (16u * 1024u * 1024u)      /* 16 MB */
 
+/* Growth: the heap maps further segments on demand */
+#define HEAP_SEGMENT_SIZE   (1u * 1024u * 1024u)     /* min growth step */
+#ifndef MAX_HEAP_TOTAL_SIZE
+#define MAX_HEAP_TOTAL_SIZE ((size_t)1u << 30)       /* 1 GB across segments */
+#endif
+
+/* Segment map: segments start on 2^HEAP_SEGMENT_SHIFT boundaries */
+#define HEAP_SEGMENT_SHIFT 20u                       /* 1 MB granules */
+#define HEAP_ADDR_BITS     48u                       /* user address width */
+
 /* Allocation constraints */
 #define MIN_HEAP_UNITS    2u                         /* minimum block count */
 
+/* Segregated free bins */
+#define HEAP_SMALL_BIN_SHIFT 6u                      /* log2(exact-size bins) */
+#define HEAP_SMALL_BINS   (1u << HEAP_SMALL_BIN_SHIFT) /* one per header unit */
+#define HEAP_BIN_SUB_BITS 2u                         /* log2(bins per doubling) */
+#define HEAP_NUM_BINS     128u                       /* total bin count */
+
+/* Free blocks this large live in a best-fit size tree (0 = bins only) */
+#ifndef HEAP_TREE_MIN_BYTES
+#define HEAP_TREE_MIN_BYTES (4u * 1024u)
+#endif
+
+/*
+ * Pool size classes, block bytes with the block header: HEAP_POOL_QUANTUM
+ * steps up to 2^HEAP_POOL_SMALL_SHIFT, then 2^HEAP_POOL_SUB_BITS classes per
+ * power of two up to 2^HEAP_POOL_MAX_SHIFT. Larger requests use the heap.
+ */
+#ifndef HEAP_POOL_QUANTUM
+#define HEAP_POOL_QUANTUM 16u                        /* power of two, >= 16 */
+#endif
+#ifndef HEAP_POOL_SMALL_SHIFT
+#define HEAP_POOL_SMALL_SHIFT 8u                     /* 256 */
+#endif
+#ifndef HEAP_POOL_SUB_BITS
+#define HEAP_POOL_SUB_BITS 2u                        /* quarter steps */
+#endif
+#ifndef HEAP_POOL_MAX_SHIFT
+#define HEAP_POOL_MAX_SHIFT 10u                      /* 1024 */
+#endif
+
+/*
+ * Thread safety: locks and per-thread block caches (0 = single-threaded).
+ * The caches hold arena blocks past the pools' largest class.
+ */
+#ifndef HEAP_THREAD_SAFE
+#define HEAP_THREAD_SAFE 1
+#endif
+
+#define HEAP_TCACHE_MAX_BYTES 2048u                  /* largest cached block */
+#define HEAP_TCACHE_COUNT     32u                    /* blocks per class */
+#define HEAP_TCACHE_BATCH     16u                    /* refill/flush batch */
+#define HEAP_POOL_CACHE_COUNT 64u                    /* own pooled frees kept */
+
+/*
+ * Hardening level, fixed at compile time (make HARDENING=full|cheap|none):
+ * CHEAP checks pointers and header magic on hfree/hrealloc, FULL also puts
+ * fences around payloads and poisons freed ones, NONE trusts every pointer.
+ */
+#define HEAP_HARDEN_NONE  0
+#define HEAP_HARDEN_CHEAP 1
+#define HEAP_HARDEN_FULL  2
+
+#ifndef HEAP_HARDENING
+#define HEAP_HARDENING HEAP_HARDEN_FULL
+#endif
+
+/* Fill freed payloads with 0xDE (runtime switch: heap_set_poison; FULL only) */
+#ifndef HEAP_POISON_FREE
+#define HEAP_POISON_FREE 1
+#endif
+
+/* Refuse bursts of same-size allocations (see heap_spray.c; 0 = off) */
+#ifndef HEAP_SPRAY_CHECK
+#define HEAP_SPRAY_CHECK 1
+#endif
+
+/* Huge pages (HeapConfig.huge_pages): segments round up to this size */
+#define HEAP_HUGE_PAGE_BYTES (2u * 1024u * 1024u)
+
+/* Arenas: independent heaps that threads are spread across */
+#define HEAP_MAX_ARENAS 64u
+
+/* Blocks of at least this many bytes get their own mapping */
+#define HEAP_MMAP_THRESHOLD (128u * 1024u)
+
+/* Scavenger: free blocks this large give their pages back once decayed */
+#define HEAP_SCAVENGE_MIN_BYTES (64u * 1024u)
+#define HEAP_SCAVENGE_DECAY_MS  1000u                /* free time before release */
+
+/* Regions (harena_*): first chunk size; each new chunk doubles the last */
+#define HEAP_REGION_CHUNK_BYTES (16u * 1024u)
+
 #endif /* HEAP_CONFIG_H */
@@ -3,6 +3,23 @@
 
 #include "heap.h"
 #include "heap_internal.h"
+#include "heap_lock.h"
+#include "heap_pool.h"
+
+#define MAX_ROOTS 1024
+
+/* Root table of one heap */
+typedef struct {
+  void** roots[MAX_ROOTS];
+  int count;
+  HeapLock lock;
+} GcRoots;
+
+/* Roots of heap h (NULL = default); the tables live in heap_core.c */
+GcRoots* heap_roots(Heap* h);
+
+/* Pools of heap h (NULL = default), traced along with its blocks */
+PoolSet* heap_pools(Heap* h);
 
 /* Register a pointer-to-pointer as a root (e.g., &my_ptr) */
 void gc_add_root(void** root);
@@ -13,4 +30,9 @@ void gc_remove_root(void** root);
 /* Run a full mark-and-sweep collection cycle */
 void gc_collect(void);
 
+/* The same for one heap (NULL = default); instances collect independently */
+void heap_gc_add_root(Heap* h, void** root);
+void heap_gc_remove_root(Heap* h, void** root);
+void heap_gc_collect(Heap* h);
+
 #endif /* HEAP_GARBAGE_H */
\ No newline at end of file
@@ -4,27 +4,38 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "heap_config.h"
+
 /* Block magic values */
 #define HEAP_MAGIC_ALLOC 0xDEADBEEF
 #define HEAP_MAGIC_FREE 0xBAADF00D
+#define HEAP_MAGIC_CACHED 0xCAC4EB10 /* parked in a thread cache */
 
-/* Payload fence */
+/* Payload fence (only the FULL hardening level has one) */
+#if HEAP_HARDENING >= HEAP_HARDEN_FULL
 #define FENCE_SIZE 16
+#else
+#define FENCE_SIZE 0
+#endif
 #define FENCE_PATTERN 0xFE
 
 /* Worst-case alignment */
 typedef long Align;
 
+/*
+ * Block header, 16 bytes so payloads stay max_align_t aligned. Free-list
+ * links are not part of it: they live in the body of free blocks (see
+ * FREE_NEXT), so an in-use block pays for size, flags and magic only.
+ */
 typedef union header {
   struct {
-    union header* next_ptr; /* circular free list */
     size_t size;            /* size incl. header + flags */
-    uint32_t magic;         /* corruption check */
-    uint32_t _pad;          /* 8-byte alignment */
+    uint32_t magic;         /* corruption check and block state */
+    uint32_t freed_ms;      /* large free blocks: when freed (scavenger) */
   } Info;
 
   Align x;
-  char _force_size[32]; /* force power-of-two size */
+  char _force_size[16]; /* force power-of-two size */
 } Header;
 
 /* Header properties */
@@ -46,18 +57,82 @@ typedef char __header_size_must_be_power_of_two
 /* GC mark bit (use highest available bit) */
 #define HEAP_FLAG_MARK ((size_t)0x2)
 
+/* Physically preceding block is in use (no footer to read) */
+#define HEAP_FLAG_PREV_INUSE ((size_t)0x4)
+
+/* Free block whose bytes past the header are zero, bar links and footer */
+#define HEAP_FLAG_ZERO ((size_t)0x8)
+
 /* Helpers */
 
+/*
+ * A block's PREV_INUSE bit is flipped (under the heap lock) by whoever
+ * allocates or frees its physical neighbour, while the block's owner may read
+ * its size without the lock. The word is therefore read with relaxed atomic
+ * loads and PREV_INUSE is updated with atomic read-modify-writes.
+ */
+#if HEAP_THREAD_SAFE
+#define SIZE_WORD(p) __atomic_load_n(&(p)->Info.size, __ATOMIC_RELAXED)
+#define SIZE_WORD_OR(p, f) \
+  ((void)__atomic_fetch_or(&(p)->Info.size, (f), __ATOMIC_RELAXED))
+#define SIZE_WORD_AND(p, f) \
+  ((void)__atomic_fetch_and(&(p)->Info.size, (f), __ATOMIC_RELAXED))
+#else
+#define SIZE_WORD(p) ((p)->Info.size)
+#define SIZE_WORD_OR(p, f) ((void)((p)->Info.size |= (f)))
+#define SIZE_WORD_AND(p, f) ((void)((p)->Info.size &= (f)))
+#endif
+
 /* Calculate total block size in bytes */
-#define BLOCK_BYTES(p) ((p)->Info.size & HEAP_SIZE_MASK)
+#define BLOCK_BYTES(p) (SIZE_WORD(p) & HEAP_SIZE_MASK)
 
-#define IS_INUSE(p) (((p)->Info.size & HEAP_FLAG_INUSE) != 0)
+#define IS_INUSE(p) ((SIZE_WORD(p) & HEAP_FLAG_INUSE) != 0)
 #define SET_INUSE(p) ((p)->Info.size |= HEAP_FLAG_INUSE)
 #define CLEAR_INUSE(p) ((p)->Info.size &= ~HEAP_FLAG_INUSE)
 
-#define IS_MARKED(p)   (((p)->Info.size & HEAP_FLAG_MARK) != 0)
+#define IS_MARKED(p)   ((SIZE_WORD(p) & HEAP_FLAG_MARK) != 0)
 #define SET_MARK(p)    ((p)->Info.size |= HEAP_FLAG_MARK)
 #define CLEAR_MARK(p)  ((p)->Info.size &= ~HEAP_FLAG_MARK)
 
+#define IS_PREV_INUSE(p)    ((SIZE_WORD(p) & HEAP_FLAG_PREV_INUSE) != 0)
+#define SET_PREV_INUSE(p)   SIZE_WORD_OR(p, HEAP_FLAG_PREV_INUSE)
+#define CLEAR_PREV_INUSE(p) SIZE_WORD_AND(p, ~HEAP_FLAG_PREV_INUSE)
+
+#define IS_ZERO(p)    ((SIZE_WORD(p) & HEAP_FLAG_ZERO) != 0)
+#define SET_ZERO(p)   SIZE_WORD_OR(p, HEAP_FLAG_ZERO)
+#define CLEAR_ZERO(p) SIZE_WORD_AND(p, ~HEAP_FLAG_ZERO)
+
+/* Free-list links, stored in the body of a free (or cached) block */
+#define FREE_LINK_BYTES (2 * sizeof(Header*))
+#define FREE_NEXT(p) (((Header**)((p) + 1))[0])
+#define FREE_PREV(p) (((Header**)((p) + 1))[1])
+
+/* Free blocks in the size tree use the same two words as child links */
+#define TREE_LEFT(p) FREE_NEXT(p)
+#define TREE_RIGHT(p) FREE_PREV(p)
+
+/*
+ * Payloads sit right after header and pre fence, on a header boundary, so
+ * an aligned block is just a block placed where its payload is aligned.
+ */
+#define BLOCK_PAYLOAD_OFFSET (HEADER_SIZE_BYTES + FENCE_SIZE)
+#define BLOCK_PAYLOAD(p) ((uint8_t*)(p) + BLOCK_PAYLOAD_OFFSET)
+#define BLOCK_PAYLOAD_BYTES(p) \
+  (BLOCK_BYTES(p) - BLOCK_PAYLOAD_OFFSET - FENCE_SIZE)
+
+/* Header of the block whose payload starts at ptr */
+#define PAYLOAD_HEADER(ptr) \
+  ((Header*)((uint8_t*)(ptr) - BLOCK_PAYLOAD_OFFSET))
+
+/* Replace the size, keeping the flag bits */
+#define SET_BLOCK_BYTES(p, n) \
+  ((p)->Info.size = ((n) & HEAP_SIZE_MASK) | (SIZE_WORD(p) & SIZE_ALIGN_MASK))
+
+/* Boundary tag: free blocks repeat their size in the last word */
+#define BLOCK_FOOTER(p) ((size_t*)((char*)(p) + BLOCK_BYTES(p)) - 1)
+
+/* Footer of the block physically before p (valid if !IS_PREV_INUSE(p)) */
+#define PREV_FOOTER(p) ((size_t*)(p) - 1)
+
 
 #endif /* HEAP_INTERNAL_H */
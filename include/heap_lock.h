@@ -0,0 +1,42 @@
+#ifndef HEAP_LOCK_H
+#define HEAP_LOCK_H
+
+#include "heap_config.h"
+
+/* Mutex wrappers that compile away when HEAP_THREAD_SAFE is 0 */
+#if HEAP_THREAD_SAFE
+
+#include <pthread.h>
+
+typedef pthread_mutex_t HeapLock;
+
+#define HEAP_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+
+#define heap_lock_init(l) pthread_mutex_init((l), NULL)
+#define heap_lock_init_recursive(l)                            \
+  do {                                                         \
+    pthread_mutexattr_t _attr;                                 \
+    pthread_mutexattr_init(&_attr);                            \
+    pthread_mutexattr_settype(&_attr, PTHREAD_MUTEX_RECURSIVE); \
+    pthread_mutex_init((l), &_attr);                           \
+    pthread_mutexattr_destroy(&_attr);                         \
+  } while (0)
+#define heap_lock_try(l) (pthread_mutex_trylock(l) == 0)
+#define heap_lock_acquire(l) pthread_mutex_lock(l)
+#define heap_lock_release(l) pthread_mutex_unlock(l)
+
+#else
+
+typedef int HeapLock;
+
+#define HEAP_LOCK_INITIALIZER 0
+
+#define heap_lock_init(l) ((void)(l))
+#define heap_lock_init_recursive(l) ((void)(l))
+#define heap_lock_try(l) ((void)(l), 1)
+#define heap_lock_acquire(l) ((void)(l))
+#define heap_lock_release(l) ((void)(l))
+
+#endif /* HEAP_THREAD_SAFE */
+
+#endif /* HEAP_LOCK_H */
@@ -4,36 +4,154 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "heap_config.h"
 #include "heap_errors.h"
+#include "heap_lock.h"
 
-#define NUM_POOLS 4
-#define POOL_BLOCKS_PER_SIZE 1
+/* Size classes (see HEAP_POOL_* in heap_config.h): linear, then log-spaced */
+#define POOL_SMALL_CLASSES \
+  ((1u << HEAP_POOL_SMALL_SHIFT) / HEAP_POOL_QUANTUM - 1u)
+#define NUM_POOLS                                                    \
+  ((int)(POOL_SMALL_CLASSES + ((HEAP_POOL_MAX_SHIFT - HEAP_POOL_SMALL_SHIFT) \
+                               << HEAP_POOL_SUB_BITS)))
+
+/* Pools grow by slabs of this many bytes, each aligned to its size */
+#define POOL_SLAB_SHIFT 16u
+#define POOL_SLAB_BYTES (1u << POOL_SLAB_SHIFT)    /* 64 KB */
+
+struct PoolOwner;
 
 /* Single block inside a memory pool */
 typedef struct PoolBlock {
-  struct PoolBlock* next;
+  union {
+    struct PoolBlock* next;   /* free: next block on its list */
+    struct PoolOwner* owner;  /* handed out: its thread, NULL = none */
+  };
+  size_t depth;               /* blocks below it on the free stack */
 } PoolBlock;
 
-/* Fixed-size memory pool metadata */
-typedef struct {
-  size_t block_size;        /* size of each block */
-  size_t total_blocks;      /* total blocks in pool */
-  PoolBlock* free_list;     /* free block list */
-  void* pool_mem;           /* raw pool memory */
+struct MemoryPool;
+
+/*
+ * One slab: a header with one allocation bit and one GC mark bit per block,
+ * then the blocks back to back. Slabs are aligned to their size, so masking a
+ * block address gives its slab.
+ */
+typedef struct PoolSlab {
+  struct PoolSlab* next;    /* neighbours in its slab list */
+  struct PoolSlab* prev;
+  struct MemoryPool* pool;  /* owning size class */
+  PoolBlock* free_list;     /* free blocks of this slab */
+  size_t total_blocks;      /* blocks in this slab */
+  size_t used_blocks;       /* blocks out of the slab: in use or on the stack */
+  size_t peak_used;         /* max used blocks */
+  unsigned pages;           /* SEGMENT_PAGES_*: how the slab is backed */
+  uint64_t used_map[];      /* bit set => block handed out; the GC's mark
+                               bits follow, as many words again */
+} PoolSlab;
+
+/* Size class metadata: a growing list of slabs of one block size */
+typedef struct MemoryPool {
+  size_t block_size;        /* size of each block, 0 = pool unusable */
+  size_t slab_bytes;        /* bytes (and alignment) of each slab */
+  size_t slab_header_bytes; /* header and bitmaps, up to the first block */
+  size_t slab_blocks;       /* blocks per slab */
+  size_t map_words;         /* words in each slab bitmap */
+  int huge_pages;           /* slabs on huge pages */
+  PoolSlab* partial;        /* slabs with free blocks */
+  PoolSlab* full;           /* slabs without */
+  PoolSlab* retired;        /* empty slabs with their pages given back */
+  uint64_t free_head;       /* lock-free free stack: tag | top block */
+  size_t slabs;             /* slabs mapped */
+  size_t empty_slabs;       /* slabs with no block in use (at most one kept) */
+  size_t total_blocks;      /* total blocks in all slabs */
 
-  size_t used_blocks;       /* currently used blocks */
-  size_t free_blocks;       /* currently free blocks */
+  /* relaxed atomics, updated outside the class lock */
+  size_t used_blocks;       /* blocks held by callers */
   size_t peak_used;         /* max used blocks */
 
   size_t alloc_requests;    /* allocation calls */
+  size_t served_blocks;     /* blocks handed out by those calls */
+  size_t requested_bytes;   /* payload bytes asked for with them */
   size_t free_requests;     /* free calls */
-  size_t alloc_failures;    /* failed allocations */
+  size_t alloc_failures;    /* allocations no slab could be mapped for */
 } MemoryPool;
 
+/* One pool per size class: the default heap's set or a heap instance's */
+typedef struct {
+  MemoryPool pools[NUM_POOLS];
+  HeapLock locks[NUM_POOLS];  /* guard the slab lists and slab free lists */
+} PoolSet;
 
+/* The default heap's pools */
+PoolSet* pool_default_set(void);
 void* pool_alloc(size_t size);
-void init_pools(void);
+size_t pool_alloc_batch(size_t size, size_t n, void** out);
+void init_pools(int huge_pages);
 int pool_free(void* ptr);
+int pool_free_sized(void* ptr, size_t size);
+
+/* usable payload bytes of a pooled block, 0 if ptr is not one */
+size_t pool_usable_size(const void* ptr);
+/* whether ptr is a pooled block that is allocated, not freed */
+int pool_in_use(const void* ptr);
+
+/* pthread_atfork handlers for the pool locks (see heap_core.c) */
+void pool_fork_prepare(void);
+void pool_fork_parent(void);
+void pool_fork_child(void);
+
+/* The same for an explicit set (see heap_create) */
+void pool_set_init(PoolSet* set, int huge_pages);
+void pool_set_destroy(PoolSet* set);
+void* pool_set_alloc(PoolSet* set, size_t size);
+int pool_set_free(PoolSet* set, void* ptr);
+size_t pool_set_usable_size(PoolSet* set, const void* ptr);
+int pool_set_in_use(PoolSet* set, const void* ptr);
+void pool_set_fork_prepare(PoolSet* set);
+void pool_set_fork_parent(PoolSet* set);
+void pool_set_fork_child(PoolSet* set);
+
+/*
+ * GC support: pooled blocks are traced like heap blocks but never swept.
+ * pool_set_gc_clear drops every mark; pool_set_gc_mark marks the live block
+ * whose payload is ptr and returns its payload bytes, 0 if ptr is not one or
+ * was marked already.
+ */
+void pool_set_gc_clear(PoolSet* set);
+size_t pool_set_gc_mark(PoolSet* set, const void* ptr);
+
+/* One size class's counters, as kept by pool_alloc and pool_free */
+typedef struct {
+  size_t block_size;      /* 0 = class unusable */
+  size_t slabs;           /* slabs mapped (retired ones not counted) */
+  size_t total_blocks;    /* blocks in those slabs */
+  size_t used_blocks;     /* blocks held by callers */
+  size_t peak_used;       /* max used blocks */
+  size_t alloc_requests;  /* allocation calls */
+  size_t served_blocks;   /* blocks handed out by those calls */
+  size_t requested_bytes; /* payload bytes asked for with them */
+  size_t free_requests;   /* free calls */
+  size_t alloc_failures;  /* allocations no slab could be mapped for */
+} PoolClassStats;
+
+/* Every class of a pool set, plus totals */
+typedef struct {
+  PoolClassStats classes[NUM_POOLS];
+  size_t mapped_bytes;    /* slab bytes, all classes */
+  size_t used_bytes;      /* block bytes held by callers */
+  size_t free_bytes;      /* block bytes free in the slabs */
+  size_t free_blocks;     /* blocks free in the slabs */
+  double fragmentation;   /* payload handed out but never asked for */
+} PoolStats;
+
+/*
+ * Snapshot of the counters: no slab is walked and the lock-free paths are
+ * never blocked, so it can be polled. Counts of different classes are read
+ * at slightly different moments.
+ */
+HeapErrorCode pool_get_stats(PoolStats* out);
+HeapErrorCode pool_set_get_stats(PoolSet* set, PoolStats* out);
 
 /* print pool statistics */
 void pool_print_stats(void);
@@ -0,0 +1,27 @@
+#ifndef HEAP_REGION_H
+#define HEAP_REGION_H
+
+#include <stddef.h>
+
+#include "heap_errors.h"
+
+/*
+ * Region: bump allocation for objects that all die together. Chunks come
+ * from halloc; objects carry no header or fence and are never freed one by
+ * one. A region belongs to one thread at a time.
+ */
+typedef struct HeapRegion HeapRegion;
+
+/* New region whose first chunk holds chunk_bytes (0 = HEAP_REGION_CHUNK_BYTES) */
+HeapRegion* harena_create(size_t chunk_bytes);
+
+/* size zeroed bytes, aligned like halloc; NULL (error set) on failure */
+void* harena_alloc(HeapRegion* r, size_t size);
+
+/* Drop every object at once; the chunks are kept for reuse */
+void harena_reset(HeapRegion* r);
+
+/* Give all chunks back to the heap */
+void harena_destroy(HeapRegion* r);
+
+#endif /* HEAP_REGION_H */
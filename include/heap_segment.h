@@ -0,0 +1,62 @@
+#ifndef HEAP_SEGMENT_H
+#define HEAP_SEGMENT_H
+
+#include <stddef.h>
+
+#include "heap_internal.h"
+
+struct HeapState;
+
+/* One mmap'd region of the heap with its own block chain */
+typedef struct Segment {
+  struct Segment* next;     /* next segment of the same arena/list */
+  struct Segment* prev;     /* previous direct segment (direct list only) */
+  struct HeapState* arena;  /* owning arena, NULL for a direct mapping */
+  size_t size;              /* mapped bytes, including this header */
+  unsigned pages;           /* SEGMENT_PAGES_*: how the mapping is backed */
+  Header* blocks;           /* first block header */
+  Header* end;              /* in-use sentinel closing the chain */
+} Segment;
+
+/* Bytes reserved at the start of a segment before the first block */
+#define SEGMENT_HEADER_BYTES \
+  ((sizeof(Segment) + HEADER_SIZE_BYTES - 1) & ~(HEADER_SIZE_BYTES - 1))
+
+/* Page backing of a mapping */
+#define SEGMENT_PAGES_BASE    0u  /* base pages */
+#define SEGMENT_PAGES_THP     1u  /* madvise(MADV_HUGEPAGE): the kernel decides */
+#define SEGMENT_PAGES_HUGETLB 2u  /* MAP_HUGETLB: reserved huge pages */
+
+/*
+ * mmap `bytes` on an `align` boundary. With huge set (`bytes` a multiple of
+ * HEAP_HUGE_PAGE_BYTES) try reserved huge pages first, then a huge-aligned
+ * range advised for transparent huge pages. *pages reports the backing.
+ */
+void* segment_map(size_t bytes, size_t align, int huge, unsigned* pages);
+
+/* Map a segment of `bytes` (page multiple, huge page multiple if huge) */
+Segment* segment_create(size_t bytes, int huge);
+
+/* Same, starting on an `align` boundary (power of two, at least a granule) */
+Segment* segment_create_aligned(size_t bytes, size_t align);
+
+/* Unregister and unmap a segment */
+void segment_destroy(Segment* seg);
+
+/*
+ * Resize a segment to `bytes` (page multiple) without copying its pages:
+ * shrink or grow in place, else move the pages to a new aligned range with
+ * mremap. Returns the segment's (possibly new) address, NULL on failure.
+ */
+Segment* segment_resize(Segment* seg, size_t bytes);
+
+/*
+ * Hand the pages of [addr, addr + bytes) (page aligned) back to the OS. They
+ * stay mapped and read as zero when next touched. Returns the bytes released.
+ */
+size_t segment_decommit(void* addr, size_t bytes);
+
+/* Segment containing ptr, NULL if ptr is not inside any segment */
+Segment* heap_segment_of(const void* ptr);
+
+#endif /* HEAP_SEGMENT_H */
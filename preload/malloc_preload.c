@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+
+/*
+ * The standard malloc family on top of halloc/hfree, for running unmodified
+ * programs with LD_PRELOAD=bin/libbualloc.so. Built by `make lib` without
+ * the spray check, which real programs trip all the time.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "heap.h"
+
+/* The heap comes up on the first call, whichever function that is */
+static int preload_ready(void) {
+  static int ready;
+  if (__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) return 1;
+  if (hinit(0) != HEAP_SUCCESS) return 0;
+  __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/*
+ * The heap reports success through errno too; malloc must leave errno
+ * alone unless it fails, and then it says ENOMEM.
+ */
+static void* preload_result(void* p, int saved_errno) {
+  errno = p ? saved_errno : ENOMEM;
+  return p;
+}
+
+void* malloc(size_t size) {
+  int saved = errno;
+  if (!preload_ready()) return preload_result(NULL, saved);
+  return preload_result(halloc_uninit(size ? size : 1), saved);
+}
+
+void free(void* ptr) {
+  if (!ptr) return;
+  int saved = errno;
+  hfree(ptr);
+  errno = saved;
+}
+
+void free_sized(void* ptr, size_t size) {
+  if (!ptr) return;
+  int saved = errno;
+  hfree_sized(ptr, size);
+  errno = saved;
+}
+
+void* calloc(size_t count, size_t size) {
+  int saved = errno;
+  if (!preload_ready()) return preload_result(NULL, saved);
+  if (!count || !size) count = size = 1;
+  return preload_result(hcalloc(count, size), saved);
+}
+
+void* realloc(void* ptr, size_t size) {
+  if (!ptr) return malloc(size);
+  if (!size) {
+    free(ptr);
+    return NULL;
+  }
+  int saved = errno;
+  return preload_result(hrealloc(ptr, size), saved);
+}
+
+void* reallocarray(void* ptr, size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return realloc(ptr, count * size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  int saved = errno;
+  if (!preload_ready()) return ENOMEM;
+  int res = hposix_memalign(memptr, alignment, size ? size : 1);
+  errno = saved;
+  return res;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  int saved = errno;
+  if (!preload_ready()) return preload_result(NULL, saved);
+  void* p = haligned_alloc(alignment, size ? size : 1);
+  if (!p && heap_last_error() == HEAP_ALIGNMENT_ERROR) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return preload_result(p, saved);
+}
+
+/* Unlike aligned_alloc, memalign rounds odd alignments up */
+void* memalign(size_t alignment, size_t size) {
+  size_t align = sizeof(void*);
+  while (align < alignment && align <= SIZE_MAX / 2) align <<= 1;
+  return aligned_alloc(align, size);
+}
+
+void* valloc(size_t size) {
+  return memalign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  if (size > SIZE_MAX - page) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void* ptr) {
+  if (!ptr) return 0;
+  int saved = errno;
+  size_t bytes = heap_usable_size(ptr);
+  errno = saved;
+  return bytes;
+}
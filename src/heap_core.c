@@ -2,17 +2,24 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stdalign.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "heap.h"
 #include "heap_config.h"
 #include "heap_errors.h"
+#include "heap_garbage.h"
 #include "heap_internal.h"
+#include "heap_lock.h"
 #include "heap_pool.h"
+#include "heap_segment.h"
 #include "heap_spray.h"
 
 
@@ -21,29 +28,96 @@
 /* Heap state                                                                 */
 /* -------------------------------------------------------------------------- */
 
-typedef struct {
-  Header base;
-  Header* freep;
-  void* start_addr;
-  size_t heap_size;
-  int initialized;
+#define HEAP_BINMAP_WORDS ((HEAP_NUM_BINS + 63u) / 64u)
+
+/* One arena: an independent heap with its own bins, segments and lock */
+typedef struct HeapState {
+  Header* bins[HEAP_NUM_BINS];         /* segregated free lists */
+  Header* tree;                        /* large free blocks, by size */
+  Header* tree_max;                    /* the tree's rightmost node */
+  uint64_t binmap[HEAP_BINMAP_WORDS];  /* bit set => bin non-empty */
+  size_t bin_max[HEAP_NUM_BINS - HEAP_SMALL_BINS]; /* see bin_largest() */
+  Segment* segments;                   /* oldest first */
+  Segment* last_segment;               /* append point */
+  size_t heap_size;                    /* mapped bytes, all segments */
+  unsigned index;                      /* position in _arenas */
+  struct Heap* owner;                  /* instance, NULL for the default heap */
+  unsigned decay_ms;                   /* see heap_scavenge() */
+  int huge_pages;                      /* segments on huge pages */
+  uint32_t scavenged_at;               /* last scavenger pass (heap_clock_ms) */
+  HeapLock lock;                       /* guards bins and segments */
+  HeapArenaStats stats;                /* see heap_arena_stats() */
 } HeapState;
 
-static HeapState _heap = {0};
+/* A heap instance: one arena plus its own pools and GC roots */
+struct Heap {
+  HeapState arena;
+  PoolSet pools;
+  GcRoots roots;
+  struct Heap* next;                   /* live instances, see _instances */
+  struct Heap* prev;
+};
+
+static HeapState _arenas[HEAP_MAX_ARENAS];
+static unsigned _arena_count;
+static int _initialized;
+static size_t _mapped_total;            /* bytes mapped by all arenas */
+static size_t _in_use_total;            /* bytes_in_use over all arenas */
+static size_t _peak_total;              /* max _in_use_total */
+static unsigned _next_arena;            /* round-robin assignment cursor */
+static HeapLock _init_lock = HEAP_LOCK_INITIALIZER;
+static Heap* _instances;                /* guarded by _init_lock */
+
+/* Large blocks, each in a segment of its own (see Direct mappings) */
+static Segment* _direct;
+static HeapLock _direct_lock;           /* guards _direct; recursive for GC */
+static size_t _direct_blocks;           /* under _direct_lock */
+static size_t _direct_bytes;
+static size_t _mmap_threshold;          /* block bytes that go direct */
+
+/* The default heap's GC roots; instances keep theirs in struct Heap */
+static GcRoots _roots = {.lock = HEAP_LOCK_INITIALIZER};
+
+static int _poison_free = HEAP_POISON_FREE;
+
+/* Arena serving the calling thread's allocations */
+static _Thread_local HeapState* _thread_arena;
+
+/* Initialization flag, safe to read without the lock */
+static int heap_ready(void) {
+  return __atomic_load_n(&_initialized, __ATOMIC_ACQUIRE);
+}
 
 /* -------------------------------------------------------------------------- */
 /* Utilities                                                                  */
 /* -------------------------------------------------------------------------- */
 
-/* Align given size up to nearest page size */
-static size_t align_to_pages(size_t size) {
+static size_t page_bytes(void) {
   long ps = sysconf(_SC_PAGESIZE);
-  size_t page_size = (ps > 0) ? (size_t)ps : 4096u;
+  return (ps > 0) ? (size_t)ps : 4096u;
+}
+
+/* Pages arena segments are made of: huge pages if enabled */
+static size_t segment_page_bytes(int huge_pages) {
+  return huge_pages ? HEAP_HUGE_PAGE_BYTES : page_bytes();
+}
 
+/* Align given size up to a multiple of page_size (a power of two) */
+static size_t align_to_pages(size_t size, size_t page_size) {
   if (size > SIZE_MAX - page_size) return SIZE_MAX - (SIZE_MAX % page_size);
   return ((size + page_size - 1) / page_size) * page_size;
 }
 
+/* Coarse monotonic milliseconds; wraps, so compare with differences */
+static uint32_t heap_clock_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000u +
+                    (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+#if HEAP_HARDENING >= HEAP_HARDEN_FULL
+
 /* Set fence bytes to detect buffer overruns */
 static void set_fence(uint8_t* ptr) { memset(ptr, FENCE_PATTERN, FENCE_SIZE); }
 
@@ -54,325 +128,2127 @@ static int check_fence(const uint8_t* ptr) {
   return 1;
 }
 
-/* Validate if a pointer belongs to heap and is properly aligned */
-static int is_valid_heap_ptr(void* ptr) {
-  if (!_heap.initialized || !ptr) return 0;
+#else
 
-  char* start = (char*)_heap.start_addr;
-  char* end = start + _heap.heap_size;
-  Header* bp = (Header*)((uint8_t*)ptr - FENCE_SIZE) - 1;
+/* no fences below HEAP_HARDEN_FULL */
+static void set_fence(uint8_t* ptr) { (void)ptr; }
+static int check_fence(const uint8_t* ptr) { (void)ptr; return 1; }
 
-  if ((char*)bp < start || (char*)bp >= end) return 0;
+#endif /* HEAP_HARDENING */
+
+/* Smallest block: room to hold header, free-list links and footer once free */
+#define MIN_BLOCK_BYTES                                             \
+  ((HEADER_SIZE_BYTES + FREE_LINK_BYTES + sizeof(size_t) +          \
+    SIZE_ALIGN_MASK) & ~SIZE_ALIGN_MASK)
+
+/* Instance a segment belongs to, NULL for the default heap */
+static Heap* segment_owner(const Segment* seg);
+
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+
+/* Validate if a pointer belongs to heap (NULL = default) and is aligned */
+static int is_valid_heap_ptr(Heap* heap, void* ptr) {
+  if ((!heap && !heap_ready()) || !ptr) return 0;
+
+  /* the pre fence and the magic before it must be inside a block chain */
+  uint8_t* pre = (uint8_t*)ptr - FENCE_SIZE;
+  Segment* seg = heap_segment_of(pre);
+  if (!seg || pre < (uint8_t*)(seg->blocks + 1) || pre >= (uint8_t*)seg->end)
+    return 0;
+  if (segment_owner(seg) != heap) return 0;
+
+  Header* bp = PAYLOAD_HEADER(ptr);
+  if (bp < seg->blocks) return 0;
   if ((uintptr_t)bp & (HEADER_SIZE_BYTES - 1)) return 0;
 
   size_t size = BLOCK_BYTES(bp);
-  if (size < HEADER_SIZE_BYTES || size > _heap.heap_size) return 0;
-  if (bp->Info.magic != HEAP_MAGIC_FREE && bp->Info.magic != HEAP_MAGIC_ALLOC)
+  if (size < HEADER_SIZE_BYTES || size > (size_t)((char*)seg->end - (char*)bp))
+    return 0;
+  if (bp->Info.magic != HEAP_MAGIC_FREE && bp->Info.magic != HEAP_MAGIC_ALLOC &&
+      bp->Info.magic != HEAP_MAGIC_CACHED)
     return 0;
+  if (bp->Info.magic == HEAP_MAGIC_ALLOC && BLOCK_PAYLOAD(bp) != ptr) return 0;
 
   return 1;
 }
 
-/* Find previous header in free list where a freed block should be inserted */
-static Header* find_insertion_point(Header* freed_block) {
-  Header* prev = _heap.freep;
+#endif /* HEAP_HARDENING >= HEAP_HARDEN_CHEAP */
 
-  while (1) {
-    Header* next = prev->Info.next_ptr;
+/* -------------------------------------------------------------------------- */
+/* Free bins                                                                  */
+/* -------------------------------------------------------------------------- */
 
-    if (prev == &_heap.base) {
-      if (freed_block < next || next == &_heap.base) {
-        return prev;
-      }
-    } else if (prev < freed_block && freed_block < next) {
-      return prev;
+/*
+ * Small blocks get one bin per header unit (exact size). Larger blocks are
+ * grouped into log-spaced bins, 2^HEAP_BIN_SUB_BITS per power of two. The
+ * last bin catches everything above the largest class.
+ */
+#define HEAP_BIN_SUBDIV (1u << HEAP_BIN_SUB_BITS)
+
+/* Map a block size (bytes) to its bin index */
+static size_t bin_index(size_t bytes) {
+  size_t units = bytes / HEADER_SIZE_BYTES;
+  if (units < HEAP_SMALL_BINS) return units;
+
+  unsigned lg = (unsigned)(sizeof(unsigned long long) * CHAR_BIT - 1 -
+                           (unsigned)__builtin_clzll(units));
+  size_t sub = (units >> (lg - HEAP_BIN_SUB_BITS)) & (HEAP_BIN_SUBDIV - 1);
+  size_t idx = HEAP_SMALL_BINS + (lg - HEAP_SMALL_BIN_SHIFT) * HEAP_BIN_SUBDIV +
+               sub;
+
+  return idx < HEAP_NUM_BINS ? idx : HEAP_NUM_BINS - 1;
+}
+
+/* Smallest block size (bytes) that maps to a bin */
+static size_t bin_min_bytes(size_t idx) {
+  if (idx < HEAP_SMALL_BINS) return idx * HEADER_SIZE_BYTES;
+
+  size_t lg = HEAP_SMALL_BIN_SHIFT + (idx - HEAP_SMALL_BINS) / HEAP_BIN_SUBDIV;
+  size_t sub = (idx - HEAP_SMALL_BINS) % HEAP_BIN_SUBDIV;
+  return ((HEAP_BIN_SUBDIV + sub) << (lg - HEAP_BIN_SUB_BITS)) *
+         HEADER_SIZE_BYTES;
+}
+
+/* First non-empty bin at or above idx, HEAP_NUM_BINS if none */
+static size_t binmap_next(HeapState* h, size_t idx) {
+  size_t w = idx / 64u;
+  if (w >= HEAP_BINMAP_WORDS) return HEAP_NUM_BINS;
+
+  uint64_t bits = h->binmap[w] & (~(uint64_t)0 << (idx % 64u));
+  while (!bits) {
+    if (++w >= HEAP_BINMAP_WORDS) return HEAP_NUM_BINS;
+    bits = h->binmap[w];
+  }
+  return w * 64u + (size_t)__builtin_ctzll(bits);
+}
+
+/*
+ * Free blocks of HEAP_TREE_MIN_BYTES and up are kept in a treap ordered by
+ * size, then address, instead of the bins. A treap needs no balance field:
+ * each node's priority is a hash of its address, which keeps the expected
+ * depth logarithmic with only the two child links a free block has room for.
+ * The leftmost node of at least a size is the best fit, lowest address first.
+ */
+static int in_tree(size_t bytes) {
+  return HEAP_TREE_MIN_BYTES && bytes >= HEAP_TREE_MIN_BYTES;
+}
+
+static int tree_less(const Header* a, const Header* b) {
+  size_t sa = BLOCK_BYTES(a), sb = BLOCK_BYTES(b);
+  return sa < sb || (sa == sb && a < b);
+}
+
+static uint32_t tree_priority(const Header* p) {
+  return (uint32_t)(((uint64_t)(uintptr_t)p * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/* Insert bp below t, returning the subtree's new root */
+static Header* tree_insert(Header* t, Header* bp) {
+  if (!t) {
+    TREE_LEFT(bp) = TREE_RIGHT(bp) = NULL;
+    return bp;
+  }
+
+  if (tree_less(bp, t)) {
+    Header* l = tree_insert(TREE_LEFT(t), bp);
+    if (tree_priority(l) <= tree_priority(t)) {
+      TREE_LEFT(t) = l;
+      return t;
+    }
+    TREE_LEFT(t) = TREE_RIGHT(l);  /* rotate right */
+    TREE_RIGHT(l) = t;
+    return l;
+  }
+
+  Header* r = tree_insert(TREE_RIGHT(t), bp);
+  if (tree_priority(r) <= tree_priority(t)) {
+    TREE_RIGHT(t) = r;
+    return t;
+  }
+  TREE_RIGHT(t) = TREE_LEFT(r);  /* rotate left */
+  TREE_LEFT(r) = t;
+  return r;
+}
+
+/* Join two subtrees whose keys are all below (a) and above (b) each other */
+static Header* tree_join(Header* a, Header* b) {
+  if (!a) return b;
+  if (!b) return a;
+  if (tree_priority(a) > tree_priority(b)) {
+    TREE_RIGHT(a) = tree_join(TREE_RIGHT(a), b);
+    return a;
+  }
+  TREE_LEFT(b) = tree_join(a, TREE_LEFT(b));
+  return b;
+}
+
+/* Remove bp from below t, returning the subtree's new root */
+static Header* tree_remove(Header* t, Header* bp) {
+  if (t == bp) return tree_join(TREE_LEFT(bp), TREE_RIGHT(bp));
+  if (tree_less(bp, t))
+    TREE_LEFT(t) = tree_remove(TREE_LEFT(t), bp);
+  else
+    TREE_RIGHT(t) = tree_remove(TREE_RIGHT(t), bp);
+  return t;
+}
+
+/* Smallest block of at least total bytes, lowest address among equals */
+static Header* tree_best_fit(Header* t, size_t total) {
+  Header* best = NULL;
+  while (t) {
+    if (BLOCK_BYTES(t) >= total) {
+      best = t;
+      t = TREE_LEFT(t);
+    } else {
+      t = TREE_RIGHT(t);
+    }
+  }
+  return best;
+}
+
+/* File a free block: large ones in the tree, others at the head of a bin */
+static void bin_insert(HeapState* h, Header* bp) {
+  /* only blocks the scavenger looks at need the time */
+  if (BLOCK_BYTES(bp) >= HEAP_SCAVENGE_MIN_BYTES)
+    bp->Info.freed_ms = heap_clock_ms();
+  h->stats.free_bytes += BLOCK_BYTES(bp);
+  h->stats.free_blocks++;
+  if (in_tree(BLOCK_BYTES(bp))) {
+    h->tree = tree_insert(h->tree, bp);
+    if (!h->tree_max || tree_less(h->tree_max, bp)) h->tree_max = bp;
+    return;
+  }
+
+  size_t idx = bin_index(BLOCK_BYTES(bp));
+  if (idx >= HEAP_SMALL_BINS) {
+    size_t* top = &h->bin_max[idx - HEAP_SMALL_BINS];
+    if (BLOCK_BYTES(bp) > *top) *top = BLOCK_BYTES(bp);
+  }
+  Header* head = h->bins[idx];
+  FREE_PREV(bp) = NULL;
+  FREE_NEXT(bp) = head;
+  if (head) FREE_PREV(head) = bp;
+  h->bins[idx] = bp;
+  h->binmap[idx / 64u] |= (uint64_t)1 << (idx % 64u);
+}
+
+/* Unlink a free block from its bin (size must be unchanged since insert) */
+static void bin_remove(HeapState* h, Header* bp) {
+  h->stats.free_bytes -= BLOCK_BYTES(bp);
+  h->stats.free_blocks--;
+  if (in_tree(BLOCK_BYTES(bp))) {
+    h->tree = tree_remove(h->tree, bp);
+    if (bp == h->tree_max) {
+      /* the predecessor is on the new right spine, as deep as the removal */
+      Header* t = h->tree;
+      while (t && TREE_RIGHT(t)) t = TREE_RIGHT(t);
+      h->tree_max = t;
     }
-    else if (prev >= next && (freed_block > prev || freed_block < next)) {
-      return prev;
+    return;
+  }
+
+  size_t idx = bin_index(BLOCK_BYTES(bp));
+
+  if (FREE_PREV(bp))
+    FREE_NEXT(FREE_PREV(bp)) = FREE_NEXT(bp);
+  else
+    h->bins[idx] = FREE_NEXT(bp);
+  if (FREE_NEXT(bp)) FREE_PREV(FREE_NEXT(bp)) = FREE_PREV(bp);
+
+  if (!h->bins[idx]) {
+    h->binmap[idx / 64u] &= ~((uint64_t)1 << (idx % 64u));
+    if (idx >= HEAP_SMALL_BINS) h->bin_max[idx - HEAP_SMALL_BINS] = 0;
+  }
+}
+
+/*
+ * Size of the largest free block, without walking a free list: the tree's
+ * rightmost node, else the top bin's size. A ranged bin reports the largest
+ * block filed since it was last empty, an upper bound once that one leaves.
+ */
+static size_t bin_largest(HeapState* h) {
+  if (h->tree_max) return BLOCK_BYTES(h->tree_max);
+
+  for (size_t w = HEAP_BINMAP_WORDS; w-- > 0;) {
+    if (!h->binmap[w]) continue;
+    size_t idx = w * 64u + 63u - (size_t)__builtin_clzll(h->binmap[w]);
+    if (idx < HEAP_SMALL_BINS) return bin_min_bytes(idx);  /* exact size */
+    size_t largest = h->bin_max[idx - HEAP_SMALL_BINS];
+    return largest < h->stats.free_bytes ? largest : h->stats.free_bytes;
+  }
+  return 0;
+}
+
+/* Find a free block of at least total bytes; large requests get a best fit */
+static Header* bin_find_fit(HeapState* h, size_t total) {
+  if (in_tree(total)) return tree_best_fit(h->tree, total);
+
+  size_t idx = bin_index(total);
+
+  /* ranged bins may hold smaller blocks: any bin above is a guaranteed fit */
+  size_t first = (bin_min_bytes(idx) < total) ? idx + 1 : idx;
+  size_t found = binmap_next(h, first);
+  if (found < HEAP_NUM_BINS) return h->bins[found];
+
+  /* last resort: first fit inside the requested bin itself */
+  if (first != idx) {
+    for (Header* p = h->bins[idx]; p; p = FREE_NEXT(p))
+      if (BLOCK_BYTES(p) >= total) return p;
+  }
+
+  /* no binned block fits: the smallest tree block does */
+  return tree_best_fit(h->tree, total);
+}
+
+/*
+ * Where an aligned block of total bytes would start inside free block p so
+ * its payload lands on an align boundary, NULL if it does not fit. A gap in
+ * front must be large enough to stay behind as a free block.
+ */
+static Header* aligned_spot(Header* p, size_t total, size_t align) {
+  const uintptr_t off = BLOCK_PAYLOAD_OFFSET;
+  uintptr_t start = (uintptr_t)p;
+  uintptr_t spot = ((start + off + align - 1) & ~(uintptr_t)(align - 1)) - off;
+
+  while (spot != start && spot - start < MIN_BLOCK_BYTES) spot += align;
+  if (spot + total > start + BLOCK_BYTES(p)) return NULL;
+  return (Header*)spot;
+}
+
+/* Smallest tree block of at least total bytes with an aligned spot */
+static Header* tree_find_aligned(Header* t, size_t total, size_t align,
+                                 Header** spot) {
+  for (; t; t = TREE_RIGHT(t)) {
+    if (BLOCK_BYTES(t) < total) continue;
+    Header* p = tree_find_aligned(TREE_LEFT(t), total, align, spot);
+    if (p) return p;
+    *spot = aligned_spot(t, total, align);
+    if (*spot) return t;
+  }
+  return NULL;
+}
+
+/* First-fit search for a free block that can hold an aligned block */
+static Header* bin_find_aligned(HeapState* h, size_t total, size_t align,
+                                Header** spot) {
+  for (size_t idx = binmap_next(h, bin_index(total)); idx < HEAP_NUM_BINS;
+       idx = binmap_next(h, idx + 1)) {
+    for (Header* p = h->bins[idx]; p; p = FREE_NEXT(p)) {
+      *spot = aligned_spot(p, total, align);
+      if (*spot) return p;
     }
+  }
+  return tree_find_aligned(h->tree, total, align, spot);
+}
+
+/* Write the boundary tag of a free block */
+static void set_footer(Header* bp) { *BLOCK_FOOTER(bp) = BLOCK_BYTES(bp); }
+
+/* -------------------------------------------------------------------------- */
+/* Segments                                                                   */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * Map a segment of `bytes` and turn it into one free block closed by an
+ * in-use sentinel header, so merging never runs off the end of the chain.
+ */
+static Segment* heap_add_segment(HeapState* h, size_t bytes) {
+  Segment* seg = segment_create(bytes, h->huge_pages);
+  if (!seg) return NULL;
+
+  if ((uintptr_t)seg->blocks & (HEADER_SIZE_BYTES - 1)) {
+    segment_destroy(seg);
+    heap_set_error(HEAP_ALIGNMENT_ERROR, EFAULT);
+    return NULL;
+  }
+
+  seg->arena = h;
+  seg->end->Info.size = HEAP_FLAG_INUSE;
+  seg->end->Info.magic = 0;
+
+  Header* first = seg->blocks;
+  size_t chain = (size_t)((char*)seg->end - (char*)first);
+  /* fresh mmap pages: the whole chain is known to be zero */
+  first->Info.size =
+      (chain & HEAP_SIZE_MASK) | HEAP_FLAG_PREV_INUSE | HEAP_FLAG_ZERO;
+  first->Info.magic = HEAP_MAGIC_FREE;
+  set_footer(first);
+  bin_insert(h, first);
+
+  if (h->last_segment)
+    h->last_segment->next = seg;
+  else
+    h->segments = seg;
+  h->last_segment = seg;
+  h->heap_size += bytes;
+  h->stats.mapped_bytes = h->heap_size;
+  h->stats.segments++;
+  if (seg->pages == SEGMENT_PAGES_HUGETLB) h->stats.hugetlb_bytes += bytes;
+  if (seg->pages == SEGMENT_PAGES_THP) h->stats.thp_bytes += bytes;
+
+  return seg;
+}
 
-    prev = next;
+/* Charge bytes against MAX_HEAP_TOTAL_SIZE, shared by all arenas */
+static int reserve_mapped(size_t bytes) {
+  size_t cur = __atomic_load_n(&_mapped_total, __ATOMIC_RELAXED);
+  do {
+    if (cur > MAX_HEAP_TOTAL_SIZE - bytes) return 0;
+  } while (!__atomic_compare_exchange_n(&_mapped_total, &cur, cur + bytes, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+static void release_mapped(size_t bytes) {
+  __atomic_fetch_sub(&_mapped_total, bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Grow an arena by a segment big enough for a block of total_size bytes.
+ * Segments double the arena (between HEAP_SEGMENT_SIZE and MAX_HEAP_SIZE) so
+ * the segment count stays logarithmic in the arena size.
+ */
+static int heap_grow(HeapState* h, size_t total_size) {
+  size_t overhead = SEGMENT_HEADER_BYTES + HEADER_SIZE_BYTES;
+  if (total_size > MAX_HEAP_TOTAL_SIZE - overhead) return 0;
+
+  size_t page = segment_page_bytes(h->huge_pages);
+  size_t need = align_to_pages(total_size + overhead, page);
+  size_t bytes = h->heap_size;
+  if (bytes < HEAP_SEGMENT_SIZE) bytes = HEAP_SEGMENT_SIZE;
+  if (bytes > MAX_HEAP_SIZE) bytes = MAX_HEAP_SIZE;
+  bytes = align_to_pages(bytes, page);
+  if (bytes < need) bytes = need;
+
+  /* near the cap, settle for the smallest segment that fits */
+  if (!reserve_mapped(bytes)) {
+    bytes = need;
+    if (!reserve_mapped(bytes)) return 0;
+  }
+
+  if (!heap_add_segment(h, bytes)) {
+    release_mapped(bytes);
+    return 0;
   }
+  return 1;
 }
 
 /* -------------------------------------------------------------------------- */
 /* Initialization                                                             */
 /* -------------------------------------------------------------------------- */
 
-HeapErrorCode hinit(size_t initial_bytes) {
-  if (_heap.initialized) return HEAP_SUCCESS;
-  init_pools();
+#if HEAP_THREAD_SAFE
+
+/* Background scavenger: catches memory freed before the heap went quiet */
+static void* scavenger_main(void* arg) {
+  unsigned period_ms = (unsigned)(uintptr_t)arg;
+  struct timespec ts = {.tv_sec = period_ms / 1000u,
+                        .tv_nsec = (long)(period_ms % 1000u) * 1000000L};
+  for (;;) {
+    nanosleep(&ts, NULL);
+    heap_scavenge(_arenas[0].decay_ms);
+  }
+  return NULL;
+}
+
+static void scavenger_start(unsigned period_ms) {
+  pthread_t tid;
+  if (!period_ms) return;
+  void* arg = (void*)(uintptr_t)period_ms;
+  if (pthread_create(&tid, NULL, scavenger_main, arg) == 0) pthread_detach(tid);
+}
+
+/*
+ * fork() copies the heap as it stands, so no lock may be left held by a
+ * thread the child does not have: every lock is taken before the fork,
+ * released in the parent and re-created in the child. The child starts
+ * without a background scavenger.
+ */
+static void fork_prepare(void) {
+  heap_lock_acquire(&_init_lock);
+  heap_lock();
+  pool_fork_prepare();
+  for (Heap* i = _instances; i; i = i->next) {
+    heap_lock_acquire(&i->arena.lock);
+    pool_set_fork_prepare(&i->pools);
+  }
+}
+
+static void fork_parent(void) {
+  for (Heap* i = _instances; i; i = i->next) {
+    pool_set_fork_parent(&i->pools);
+    heap_lock_release(&i->arena.lock);
+  }
+  pool_fork_parent();
+  heap_unlock();
+  heap_lock_release(&_init_lock);
+}
+
+static void fork_child(void) {
+  for (Heap* i = _instances; i; i = i->next) {
+    pool_set_fork_child(&i->pools);
+    heap_lock_init_recursive(&i->arena.lock);
+  }
+  pool_fork_child();
+  for (unsigned a = 0; a < _arena_count; a++)
+    heap_lock_init_recursive(&_arenas[a].lock);
+  heap_lock_init_recursive(&_direct_lock);
+  heap_lock_init(&_init_lock);
+}
+
+/* Once per process, by hinit or heap_create (init lock held) */
+static void fork_handlers_install(void) {
+  static int installed;
+  if (installed) return;
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+  installed = 1;
+}
+
+#else
+
+/* single-threaded builds only scavenge lazily and on request */
+static void scavenger_start(unsigned period_ms) { (void)period_ms; }
+static void fork_handlers_install(void) {}
+
+#endif /* HEAP_THREAD_SAFE */
+
+/* Reset arena h, configured from cfg */
+static void arena_init(HeapState* h, unsigned index, const HeapConfig* cfg) {
+  memset(h, 0, sizeof(*h));
+  h->index = index;
+  h->decay_ms = cfg->decay_ms ? cfg->decay_ms : HEAP_SCAVENGE_DECAY_MS;
+  h->huge_pages = cfg->huge_pages != 0;
+  heap_lock_init_recursive(&h->lock);
+}
 
-  size_t requested = initial_bytes ? initial_bytes : DEFAULT_HEAP_SIZE;
+/* Map the first segment of arena h, cfg->initial_bytes large */
+static HeapErrorCode arena_first_segment(HeapState* h, const HeapConfig* cfg) {
+  size_t requested = cfg->initial_bytes ? cfg->initial_bytes : DEFAULT_HEAP_SIZE;
   if (requested < MIN_HEAP_SIZE) requested = MIN_HEAP_SIZE;
   if (requested > MAX_HEAP_SIZE) requested = MAX_HEAP_SIZE;
 
-  size_t heap_size = align_to_pages(requested);
+  size_t heap_size =
+      align_to_pages(requested, segment_page_bytes(h->huge_pages));
   if (heap_size < HEADER_SIZE_BYTES ||
       heap_size / HEADER_SIZE_BYTES < MIN_HEAP_UNITS) {
     heap_set_error(HEAP_INVALID_SIZE, EINVAL);
     return HEAP_INIT_FAILED;
   }
 
-  void* mem = mmap(NULL, heap_size, PROT_READ | PROT_WRITE,
-                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (mem == MAP_FAILED) {
+  if (!reserve_mapped(heap_size)) {
     heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
     return HEAP_INIT_FAILED;
   }
-
-  if ((uintptr_t)mem & (HEADER_SIZE_BYTES - 1)) {
-    munmap(mem, heap_size);
-    heap_set_error(HEAP_ALIGNMENT_ERROR, EFAULT);
+  if (!heap_add_segment(h, heap_size)) {
+    release_mapped(heap_size);
     return HEAP_INIT_FAILED;
   }
+  return HEAP_SUCCESS;
+}
 
-  _heap.base.Info.next_ptr = &_heap.base;
-  _heap.base.Info.size = 0;
-  _heap.freep = &_heap.base;
-  _heap.start_addr = mem;
-  _heap.heap_size = heap_size;
-  _heap.initialized = 1;
+static HeapErrorCode hinit_locked(const HeapConfig* cfg) {
+  if (_initialized) return HEAP_SUCCESS;
+  init_pools(cfg->huge_pages != 0);
 
-  Header* first = (Header*)mem;
-  first->Info.size = heap_size & HEAP_SIZE_MASK;
-  first->Info.next_ptr = &_heap.base;
-  first->Info.magic = HEAP_MAGIC_FREE;
+  unsigned count = cfg->arenas;
+  if (count == 0) {
+    long online = HEAP_THREAD_SAFE ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    count = online > 0 ? (unsigned)online : 1u;
+  }
+  if (count > HEAP_MAX_ARENAS) count = HEAP_MAX_ARENAS;
+
+  /* arena 0 gets the initial segment, the others map on first use */
+  for (unsigned i = 0; i < count; i++) arena_init(&_arenas[i], i, cfg);
+  _arena_count = count;
 
-  _heap.base.Info.next_ptr = first;
+  /* direct blocks must never fit a thread cache class */
+  _mmap_threshold = cfg->mmap_threshold ? cfg->mmap_threshold : HEAP_MMAP_THRESHOLD;
+  if (_mmap_threshold <= HEAP_TCACHE_MAX_BYTES)
+    _mmap_threshold = HEAP_TCACHE_MAX_BYTES + 1;
+  heap_lock_init_recursive(&_direct_lock);
 
+  HeapErrorCode res = arena_first_segment(&_arenas[0], cfg);
+  if (res != HEAP_SUCCESS) return res;
+
+  __atomic_store_n(&_initialized, 1, __ATOMIC_RELEASE);
+  fork_handlers_install();
+  scavenger_start(cfg->scavenge_ms);
   heap_set_error(HEAP_SUCCESS, 0);
   return HEAP_SUCCESS;
 }
 
+HeapErrorCode hinit_config(const HeapConfig* cfg) {
+  if (!cfg) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return HEAP_INIT_FAILED;
+  }
+  if (heap_ready()) return HEAP_SUCCESS;
+
+  heap_lock_acquire(&_init_lock);
+  HeapErrorCode res = hinit_locked(cfg);
+  heap_lock_release(&_init_lock);
+  return res;
+}
+
+HeapErrorCode hinit(size_t initial_bytes) {
+  HeapConfig cfg = {.initial_bytes = initial_bytes};
+  return hinit_config(&cfg);
+}
+
 /* -------------------------------------------------------------------------- */
-/* Allocation                                                                 */
+/* Arenas                                                                     */
 /* -------------------------------------------------------------------------- */
 
-void* halloc(size_t size) {
-  if (!_heap.initialized || size == 0) {
-    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
-    return NULL;
-  }
-  if (heap_spray_check(size) == HEAP_SPRAY_DETECTED) {
-    heap_set_error(HEAP_SPRAY_ATTACK, EACCES);
-    return NULL;
-  }
+static void thread_register(void);
 
-  void* pool_ptr = pool_alloc(size);
-  if (pool_ptr != NULL) {
-    return pool_ptr;
-  }
+/* Move the calling thread to arena h */
+static HeapState* arena_assign(HeapState* h) {
+  if (_thread_arena)
+    __atomic_fetch_sub(&_thread_arena->stats.threads, 1, __ATOMIC_RELAXED);
+  else
+    thread_register();
 
-  if (size > SIZE_MAX - SIZE_ALIGN_MASK) {
-    heap_set_error(HEAP_OVERFLOW, ENOMEM);
-    return NULL;
-  }
+  __atomic_fetch_add(&h->stats.threads, 1, __ATOMIC_RELAXED);
+  _thread_arena = h;
+  return h;
+}
 
+/* Arena of the calling thread; threads are dealt out round-robin */
+static HeapState* thread_arena(void) {
+  if (_thread_arena) return _thread_arena;
 
-  size_t payload_size = (size + SIZE_ALIGN_MASK) & ~SIZE_ALIGN_MASK;
-  if (payload_size > SIZE_MAX - HEADER_SIZE_BYTES - 2 * FENCE_SIZE) {
-    heap_set_error(HEAP_OVERFLOW, ENOMEM);
-    return NULL;
-  }
+  unsigned n = __atomic_fetch_add(&_next_arena, 1, __ATOMIC_RELAXED);
+  return arena_assign(&_arenas[n % _arena_count]);
+}
 
-  size_t total_size = HEADER_SIZE_BYTES + payload_size + 2 * FENCE_SIZE;
-  if (total_size > _heap.heap_size) {
-    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
-    return NULL;
-  }
+/* Lock an arena, counting the acquisitions that had to wait */
+static void arena_lock(HeapState* h) {
+#if HEAP_THREAD_SAFE
+  if (heap_lock_try(&h->lock)) return;
+  __atomic_fetch_add(&h->stats.lock_contended, 1, __ATOMIC_RELAXED);
+#endif
+  heap_lock_acquire(&h->lock);
+}
 
-  Header* prev = _heap.freep;
-  Header* p = prev->Info.next_ptr;
+static void arena_unlock(HeapState* h) { heap_lock_release(&h->lock); }
+
+/*
+ * Lock the calling thread's arena for an allocation. If another thread holds
+ * it, the caller moves on to the next arena, so contended threads spread out.
+ */
+static HeapState* arena_lock_local(void) {
+  HeapState* h = thread_arena();
+#if HEAP_THREAD_SAFE
+  if (heap_lock_try(&h->lock)) return h;
+  __atomic_fetch_add(&h->stats.lock_contended, 1, __ATOMIC_RELAXED);
+  if (_arena_count > 1) h = arena_assign(&_arenas[(h->index + 1) % _arena_count]);
+#endif
+  heap_lock_acquire(&h->lock);
+  return h;
+}
 
-  do {
-    if (!IS_INUSE(p) && BLOCK_BYTES(p) >= total_size) {
-      size_t remaining = BLOCK_BYTES(p) - total_size;
-
-      if (remaining >= HEADER_SIZE_BYTES + 2 * FENCE_SIZE) {
-        Header* tail = (Header*)((char*)p + total_size);
-        tail->Info.size = remaining & HEAP_SIZE_MASK;
-        tail->Info.next_ptr = p->Info.next_ptr;
-        tail->Info.magic = HEAP_MAGIC_FREE;
-        prev->Info.next_ptr = tail;
-        p->Info.size = total_size & HEAP_SIZE_MASK;
-      } else {
-        prev->Info.next_ptr = p->Info.next_ptr;
-      }
+/* Arena owning a heap block, found from the block's address */
+static HeapState* block_arena(Header* bp) { return heap_segment_of(bp)->arena; }
 
-      SET_INUSE(p);
-      p->Info.magic = HEAP_MAGIC_ALLOC;
+static Heap* segment_owner(const Segment* seg) {
+  return seg->arena ? seg->arena->owner : NULL;
+}
 
-      uint8_t* pre = (uint8_t*)(p + 1);
-      uint8_t* pay = pre + FENCE_SIZE;
-      uint8_t* post = pay + payload_size;
+/* -------------------------------------------------------------------------- */
+/* Scavenger (heap lock held)                                                 */
+/* -------------------------------------------------------------------------- */
 
-      set_fence(pre);
-      set_fence(post);
-      memset(pay, 0, payload_size);
+/*
+ * Large free blocks that have stayed free for the decay period give the
+ * pages inside them back to the OS. The bytes around those pages are cleared
+ * by hand, so the whole block is then known to be zero (HEAP_FLAG_ZERO) and
+ * allocations carved from it skip their memset. Hot blocks are restamped on
+ * every free and split, so they are not released only to fault straight back.
+ */
+
+/* Release the interior pages of a free block, returning the bytes released */
+static size_t block_decommit(Header* bp) {
+  /* releasing part of a huge page would only split it */
+  uintptr_t page = heap_segment_of(bp)->pages == SEGMENT_PAGES_BASE
+                       ? page_bytes()
+                       : HEAP_HUGE_PAGE_BYTES;
+  uint8_t* body = (uint8_t*)(bp + 1) + FREE_LINK_BYTES;  /* keep the links */
+  uint8_t* foot = (uint8_t*)BLOCK_FOOTER(bp);
+  uint8_t* lo = (uint8_t*)(((uintptr_t)body + page - 1) & ~(page - 1));
+  uint8_t* hi = (uint8_t*)((uintptr_t)foot & ~(page - 1));
+
+  if (hi <= lo || !segment_decommit(lo, (size_t)(hi - lo))) return 0;
+  memset(body, 0, (size_t)(lo - body));
+  memset(hi, 0, (size_t)(foot - hi));
+  SET_ZERO(bp);
+  return (size_t)(hi - lo);
+}
 
-      _heap.freep = prev;
-      heap_set_error(HEAP_SUCCESS, 0);
-      return pay;
-    }
+/* Release a free block that was freed decay_ms or more ago */
+static size_t block_scavenge(Header* p, uint32_t now, unsigned decay_ms) {
+  /* known-zero blocks are fresh or already released */
+  if (IS_ZERO(p) || BLOCK_BYTES(p) < HEAP_SCAVENGE_MIN_BYTES) return 0;
+  if ((uint32_t)(now - p->Info.freed_ms) < decay_ms) return 0;
+  return block_decommit(p);
+}
 
-    prev = p;
-    p = p->Info.next_ptr;
-  } while (p != _heap.freep);
+/* Scavenge the tree blocks below t that are large enough */
+static size_t tree_scavenge(Header* t, uint32_t now, unsigned decay_ms) {
+  size_t released = 0;
+  for (; t; t = TREE_RIGHT(t)) {
+    if (BLOCK_BYTES(t) < HEAP_SCAVENGE_MIN_BYTES) continue;
+    released += tree_scavenge(TREE_LEFT(t), now, decay_ms);
+    released += block_scavenge(t, now, decay_ms);
+  }
+  return released;
+}
 
-  heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
-  return NULL;
+/* Release every large free block of h that was freed decay_ms or more ago */
+static size_t arena_scavenge(HeapState* h, uint32_t now, unsigned decay_ms) {
+  size_t released = tree_scavenge(h->tree, now, decay_ms);
+
+  for (size_t idx = binmap_next(h, bin_index(HEAP_SCAVENGE_MIN_BYTES));
+       idx < HEAP_NUM_BINS; idx = binmap_next(h, idx + 1)) {
+    for (Header* p = h->bins[idx]; p; p = FREE_NEXT(p))
+      released += block_scavenge(p, now, decay_ms);
+  }
+
+  h->scavenged_at = now;
+  h->stats.scavenged_bytes += released;
+  return released;
 }
 
 /* -------------------------------------------------------------------------- */
-/* Free                                                                       */
+/* Block allocation (heap lock held)                                          */
 /* -------------------------------------------------------------------------- */
 
-void hfree(void* ptr) {
-  if (!_heap.initialized) {
-    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
-    return;
+/*
+ * Cut block p down to total_size bytes, returning the tail to the bins
+ * (merged with the following block if that is free). Returns 0 when the tail
+ * would be too small to be a block and p keeps it.
+ */
+static int block_trim(HeapState* h, Header* p, size_t total_size) {
+  size_t remaining = BLOCK_BYTES(p) - total_size;
+  if (remaining < MIN_BLOCK_BYTES) return 0;
+
+  /* the tail inherits p's zero bytes unless a dirty neighbour joins it */
+  size_t zero = IS_ZERO(p) ? HEAP_FLAG_ZERO : 0;
+  Header* next = (Header*)((char*)p + BLOCK_BYTES(p));
+  if (!IS_INUSE(next)) {
+    bin_remove(h, next);
+    remaining += BLOCK_BYTES(next);
+    zero = 0;
   }
 
-  if (!ptr) {
-    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
-    return;
-  }
+  Header* tail = (Header*)((char*)p + total_size);
+  tail->Info.size =
+      (remaining & HEAP_SIZE_MASK) | HEAP_FLAG_PREV_INUSE | zero;
+  tail->Info.magic = HEAP_MAGIC_FREE;
+  set_footer(tail);
+  bin_insert(h, tail);
+  SET_BLOCK_BYTES(p, total_size);
 
-  if (pool_free(ptr)) {
-    return;
-  }
+  CLEAR_PREV_INUSE((Header*)((char*)tail + remaining));
+  return 1;
+}
 
-  if (!is_valid_heap_ptr(ptr)) {
-    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
-    return;
-  }
+/*
+ * Add delta (mod SIZE_MAX + 1, so frees pass its negation) to the bytes h has
+ * handed out. The default heap also keeps a total over its arenas: they peak
+ * at different times, so the process peak is tracked here, not summed.
+ */
+static void arena_in_use(HeapState* h, size_t delta) {
+  h->stats.bytes_in_use += delta;
+  if (h->stats.bytes_in_use > h->stats.peak_in_use)
+    h->stats.peak_in_use = h->stats.bytes_in_use;
+  if (h->owner) return;
+
+  size_t now = __atomic_add_fetch(&_in_use_total, delta, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&_peak_total, __ATOMIC_RELAXED);
+  while (now > peak)
+    if (__atomic_compare_exchange_n(&_peak_total, &peak, now, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      break;
+}
 
-  Header* freed_block = (Header*)((uint8_t*)ptr - FENCE_SIZE) - 1;
+/* Hand out free block p (already out of its bin) as total_size bytes */
+static Header* block_take(HeapState* h, Header* p, size_t total_size) {
+  if (!block_trim(h, p, total_size))
+    SET_PREV_INUSE((Header*)((char*)p + BLOCK_BYTES(p)));
 
-  if (!IS_INUSE(freed_block)) {
-    heap_set_error(HEAP_DOUBLE_FREE, EINVAL);
-    return;
+  SET_INUSE(p);
+  p->Info.magic = HEAP_MAGIC_ALLOC;
+  h->stats.allocs++;
+  arena_in_use(h, BLOCK_BYTES(p));
+  return p;
+}
+
+/* Take a block of at least total_size bytes out of the bins, growing if needed */
+static Header* heap_alloc_block(HeapState* h, size_t total_size) {
+  Header* p = bin_find_fit(h, total_size);
+  if (!p && heap_grow(h, total_size)) p = bin_find_fit(h, total_size);
+  if (!p) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
   }
 
-  if (freed_block->Info.magic != HEAP_MAGIC_ALLOC) {
-    heap_set_error(HEAP_CORRUPTION_DETECTED, EFAULT);
-    return;
+  bin_remove(h, p);
+  return block_take(h, p, total_size);
+}
+
+/*
+ * Carve n blocks of total_size bytes out of a single free span, returning
+ * 0 if no span that large can be had. The last block keeps any remainder
+ * too small to split off. A known-zero span makes known-zero blocks.
+ */
+static int heap_alloc_span(HeapState* h, size_t total_size, size_t n,
+                           void** out) {
+  if (n > MAX_HEAP_TOTAL_SIZE / total_size) return 0;
+
+  Header* p = heap_alloc_block(h, n * total_size);
+  if (!p) return 0;
+
+  size_t span = BLOCK_BYTES(p);
+  size_t zero = IS_ZERO(p) ? HEAP_FLAG_ZERO : 0;
+  SET_BLOCK_BYTES(p, total_size);
+  out[0] = p;
+
+  for (size_t i = 1; i < n; i++) {
+    Header* bp = (Header*)((char*)p + i * total_size);
+    size_t bytes = i + 1 < n ? total_size : span - i * total_size;
+    bp->Info.size = bytes | HEAP_FLAG_INUSE | HEAP_FLAG_PREV_INUSE | zero;
+    bp->Info.magic = HEAP_MAGIC_ALLOC;
+    out[i] = bp;
   }
+  if (n == 1) SET_BLOCK_BYTES(p, span);
 
-  /* check fence */
-  size_t payload_size =
-      BLOCK_BYTES(freed_block) - HEADER_SIZE_BYTES - 2 * FENCE_SIZE;
-  uint8_t* pre_fence = (uint8_t*)(freed_block + 1);
-  uint8_t* payload = pre_fence + FENCE_SIZE;
-  uint8_t* post_fence = payload + payload_size;
+  h->stats.allocs += n - 1;
+  return 1;
+}
 
-  if (!check_fence(pre_fence) || !check_fence(post_fence)) {
-    heap_set_error(HEAP_BOUNDARY_ERROR, EFAULT);
-    return;
+/*
+ * Allocate a block whose payload is aligned to align bytes. The free block
+ * is split at the aligned spot; the part in front of it goes back to the
+ * bins rather than being wasted.
+ */
+static Header* heap_alloc_aligned(HeapState* h, size_t total_size,
+                                  size_t align) {
+  Header* spot;
+  Header* p = bin_find_aligned(h, total_size, align, &spot);
+  if (!p && heap_grow(h, total_size + align + MIN_BLOCK_BYTES))
+    p = bin_find_aligned(h, total_size, align, &spot);
+  if (!p) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
   }
 
-  /* poison payload */
-  memset(payload, 0xDE, payload_size);
+  bin_remove(h, p);
+  if (spot != p) {
+    size_t lead = (size_t)((char*)spot - (char*)p);
+    spot->Info.size = ((BLOCK_BYTES(p) - lead) & HEAP_SIZE_MASK) |
+                      (IS_ZERO(p) ? HEAP_FLAG_ZERO : 0);
+    SET_BLOCK_BYTES(p, lead);
+    set_footer(p);
+    bin_insert(h, p);
+  }
 
+  return block_take(h, spot, total_size);
+}
+
+/* Return an in-use block to the bins, merging both physical neighbours */
+static void heap_free_block(HeapState* h, Header* freed_block) {
+  h->stats.frees++;
+  arena_in_use(h, -BLOCK_BYTES(freed_block));
   CLEAR_INUSE(freed_block);
+  CLEAR_ZERO(freed_block);
   freed_block->Info.magic = HEAP_MAGIC_FREE;
 
-  /* Coalescing Logic */
+  /* merge with the following block if it is free (the sentinel never is) */
+  Header* next = (Header*)((char*)freed_block + BLOCK_BYTES(freed_block));
 
-  Header* prev = find_insertion_point(freed_block);
-  Header* next = prev->Info.next_ptr;
-
-  /* merge freed_block with next if adjacent */
-  if ((char*)freed_block + BLOCK_BYTES(freed_block) == (char*)next) {
-    freed_block->Info.size =
-        (BLOCK_BYTES(freed_block) + BLOCK_BYTES(next)) & HEAP_SIZE_MASK;
-    freed_block->Info.next_ptr = next->Info.next_ptr;
-  } else {
-    freed_block->Info.next_ptr = next;
+  if (!IS_INUSE(next)) {
+    bin_remove(h, next);
+    SET_BLOCK_BYTES(freed_block, BLOCK_BYTES(freed_block) + BLOCK_BYTES(next));
   }
 
-  /* merge prev with freed_block if adjacent */
-  if ((char*)prev + BLOCK_BYTES(prev) == (char*)freed_block) {
-    prev->Info.size =
-        (BLOCK_BYTES(prev) + BLOCK_BYTES(freed_block)) & HEAP_SIZE_MASK;
-    prev->Info.next_ptr = freed_block->Info.next_ptr;
-  } else {
-    prev->Info.next_ptr = freed_block;
+  /* merge into the preceding block if its boundary tag says it is free */
+  if (!IS_PREV_INUSE(freed_block)) {
+    Header* prev = (Header*)((char*)freed_block - *PREV_FOOTER(freed_block));
+    bin_remove(h, prev);
+    CLEAR_ZERO(prev);
+    SET_BLOCK_BYTES(prev, BLOCK_BYTES(prev) + BLOCK_BYTES(freed_block));
+    freed_block = prev;
   }
 
-  /* Update free list pointer */
-  _heap.freep = prev;
-  heap_set_error(HEAP_SUCCESS, 0);
-}
+  set_footer(freed_block);
+  bin_insert(h, freed_block);
 
-/* -------------------------------------------------------------------------- */
-/* Diagnostics                                                                */
-/* -------------------------------------------------------------------------- */
+  next = (Header*)((char*)freed_block + BLOCK_BYTES(freed_block));
+  CLEAR_PREV_INUSE(next);
 
-void heap_walk_dump(void) {
-  if (!_heap.initialized) {
-    printf("heap not initialized\n");
-    return;
+  /* large frees run the scavenger lazily, at most once per decay period */
+  if (BLOCK_BYTES(freed_block) >= HEAP_SCAVENGE_MIN_BYTES) {
+    uint32_t now = heap_clock_ms();
+    if ((uint32_t)(now - h->scavenged_at) >= h->decay_ms)
+      arena_scavenge(h, now, h->decay_ms);
   }
+}
 
-  printf("heap start=%p size=%zu\n", _heap.start_addr, _heap.heap_size);
-
-  char* start = (char*)_heap.start_addr;
-  char* end = start + _heap.heap_size;
-  Header* p = (Header*)start;
-  size_t idx = 0;
-
-  while ((char*)p < end && BLOCK_BYTES(p)) {
-    size_t total = BLOCK_BYTES(p);
-    uint8_t* pre = (uint8_t*)(p + 1);
-    uint8_t* pay = pre + FENCE_SIZE;
-    size_t psz = total - HEADER_SIZE_BYTES - 2 * FENCE_SIZE;
-    uint8_t* post = pay + psz;
+/* Fence a block handed out to the caller */
+static void* block_fence(Header* p) {
+  uint8_t* pay = BLOCK_PAYLOAD(p);
+  uint8_t* pre = pay - FENCE_SIZE;
+  uint8_t* post = pay + BLOCK_PAYLOAD_BYTES(p);
 
-    printf(
-        "block %zu: hdr=%p payload=%p total=%zu payload=%zu inuse=%d "
-        "magic=0x%08x fence(pre=%s post=%s)\n",
-        idx++, (void*)p, pay, total, psz, IS_INUSE(p), p->Info.magic,
-        check_fence(pre) ? "ok" : "bad", check_fence(post) ? "ok" : "bad");
+  p->Info.magic = HEAP_MAGIC_ALLOC;
+  set_fence(pre);
+  set_fence(post);
 
-    p = (Header*)((char*)p + total);
-  }
+  heap_set_error(HEAP_SUCCESS, 0);
+  return pay;
 }
 
-/* Print raw heap bytes */
-void heap_raw_dump(void) {
-  if (!_heap.initialized) return;
-
-  uint8_t* p = (uint8_t*)_heap.start_addr;
-  uint8_t* end = p + _heap.heap_size;
+/* Fence a block handed out to the caller, zeroing it unless known zero */
+static void* block_prepare(Header* p, int zero) {
+  int known_zero = IS_ZERO(p);
+  CLEAR_ZERO(p);
 
-  size_t i = 0;
-  printf("\n            ");
-  for (; p < end; p++, i++) {
-    if (i && i % 32 == 0) printf("\n            ");
-    printf("%02x ", *p);
+  /* a known-zero block was only ever written to by its links and footer */
+  if (known_zero && zero) {
+    memset(p + 1, 0, FREE_LINK_BYTES);
+    *BLOCK_FOOTER(p) = 0;
   }
-  printf("\n");
-}
 
-void* heap_start_addr(void) {
-    return _heap.start_addr;
+  void* pay = block_fence(p);
+  if (zero && !known_zero) memset(pay, 0, BLOCK_PAYLOAD_BYTES(p));
+  return pay;
 }
 
-size_t heap_total_size(void) {
-    return _heap.heap_size;
+/* -------------------------------------------------------------------------- */
+/* Direct mappings                                                            */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * Blocks of _mmap_threshold bytes or more get a segment of their own, with
+ * no arena: one block spanning the whole segment, then the sentinel. They
+ * never enter the bins, resize with mremap and are unmapped on free. The
+ * segment map makes them valid heap pointers for hfree and the GC.
+ */
+static size_t direct_map_bytes(size_t lead, size_t total_size) {
+  return align_to_pages(lead + total_size + HEADER_SIZE_BYTES, page_bytes());
 }
 
-Header* heap_first_block(void) {
-    if (!_heap.initialized) return NULL;
-    return (Header*)_heap.start_addr;
+/* Size the only block of a direct segment to fill it */
+static Header* direct_block_init(Segment* seg) {
+  Header* bp = seg->blocks;
+  seg->end->Info.size = HEAP_FLAG_INUSE;
+  seg->end->Info.magic = 0;
+  SET_BLOCK_BYTES(bp, (size_t)((char*)seg->end - (char*)bp));
+  return bp;
 }
 
-Header* heap_next_block(Header* current) {
-    if (!current) return NULL;
-    size_t size = BLOCK_BYTES(current);
-    char* next = (char*)current + size;
-    char* end = (char*)_heap.start_addr + _heap.heap_size;
-    return (next < end) ? (Header*)next : NULL;
+/*
+ * Map a segment for one block of total_size bytes; pages arrive zeroed.
+ * With align set the block is placed so its payload is aligned; the
+ * mapping is aligned too, and the gap in front is only address space.
+ */
+static Header* direct_alloc(size_t total_size, size_t align) {
+  size_t lead = SEGMENT_HEADER_BYTES;
+  if (align) {
+    size_t off = BLOCK_PAYLOAD_OFFSET;
+    lead = ((SEGMENT_HEADER_BYTES + off + align - 1) & ~(align - 1)) - off;
+  }
+
+  size_t bytes = direct_map_bytes(lead, total_size);
+  if (!reserve_mapped(bytes)) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
+  }
+
+  Segment* seg = segment_create_aligned(bytes, align);
+  if (!seg) {
+    release_mapped(bytes);
+    return NULL;
+  }
+
+  seg->blocks = (Header*)((char*)seg + lead);
+  Header* bp = seg->blocks;
+  bp->Info.size = HEAP_FLAG_INUSE | HEAP_FLAG_PREV_INUSE;
+  direct_block_init(seg);
+
+  heap_lock_acquire(&_direct_lock);
+  seg->next = _direct;
+  if (_direct) _direct->prev = seg;
+  _direct = seg;
+  _direct_blocks++;
+  _direct_bytes += bytes;
+  heap_lock_release(&_direct_lock);
+
+  return bp;
+}
+
+static void direct_free(Segment* seg) {
+  heap_lock_acquire(&_direct_lock);
+  if (seg->prev) seg->prev->next = seg->next;
+  else _direct = seg->next;
+  if (seg->next) seg->next->prev = seg->prev;
+  _direct_blocks--;
+  _direct_bytes -= seg->size;
+  heap_lock_release(&_direct_lock);
+
+  release_mapped(seg->size);
+  segment_destroy(seg);
+}
+
+/* Remap a direct block for total_size bytes; NULL if the kernel refuses */
+static Header* direct_resize(Segment* seg, size_t total_size) {
+  size_t old_bytes = seg->size;
+  size_t bytes =
+      direct_map_bytes((size_t)((char*)seg->blocks - (char*)seg), total_size);
+  if (bytes == old_bytes) return seg->blocks;
+  if (bytes > old_bytes && !reserve_mapped(bytes - old_bytes)) return NULL;
+
+  heap_lock_acquire(&_direct_lock);
+  Segment* moved = segment_resize(seg, bytes);
+  if (moved) {
+    if (moved->prev) moved->prev->next = moved;
+    else _direct = moved;
+    if (moved->next) moved->next->prev = moved;
+    _direct_bytes = _direct_bytes - old_bytes + bytes;
+  }
+  heap_lock_release(&_direct_lock);
+
+  if (!moved) {
+    if (bytes > old_bytes) release_mapped(bytes - old_bytes);
+    return NULL;
+  }
+  if (bytes < old_bytes) release_mapped(old_bytes - bytes);
+  return direct_block_init(moved);
+}
+
+#if HEAP_THREAD_SAFE
+
+/* -------------------------------------------------------------------------- */
+/* Thread cache                                                               */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * Each thread keeps up to HEAP_TCACHE_COUNT blocks per exact block size, for
+ * the arena sizes just past the pools' largest class: above TCACHE_MIN_BYTES
+ * and up to HEAP_TCACHE_MAX_BYTES. Cached blocks stay in use as far as the
+ * heap is concerned and carry HEAP_MAGIC_CACHED, so hits need no lock and the
+ * GC leaves them alone. Misses refill, and overflows flush, HEAP_TCACHE_BATCH
+ * blocks under a single lock acquisition.
+ */
+#define TCACHE_MIN_BYTES ((size_t)1 << HEAP_POOL_MAX_SHIFT)
+#define TCACHE_CLASSES \
+  ((HEAP_TCACHE_MAX_BYTES - TCACHE_MIN_BYTES) / HEADER_SIZE_BYTES)
+
+typedef struct {
+  Header* head[TCACHE_CLASSES];   /* singly linked through FREE_NEXT */
+  unsigned count[TCACHE_CLASSES];
+  int registered;                 /* exit destructor installed */
+} ThreadCache;
+
+static _Thread_local ThreadCache _tcache;
+static pthread_key_t _tcache_key;
+static pthread_once_t _tcache_once = PTHREAD_ONCE_INIT;
+
+/* Blocks of these many bytes are cached */
+static int tcache_holds(size_t bytes) {
+  return bytes > TCACHE_MIN_BYTES && bytes <= HEAP_TCACHE_MAX_BYTES;
+}
+
+static size_t tcache_class(size_t bytes) {
+  return (bytes - TCACHE_MIN_BYTES) / HEADER_SIZE_BYTES - 1;
+}
+
+static void tcache_push(ThreadCache* tc, Header* bp) {
+  size_t cls = tcache_class(BLOCK_BYTES(bp));
+  bp->Info.magic = HEAP_MAGIC_CACHED;
+  FREE_NEXT(bp) = tc->head[cls];
+  tc->head[cls] = bp;
+  tc->count[cls]++;
+}
+
+static Header* tcache_pop(ThreadCache* tc, size_t cls) {
+  Header* bp = tc->head[cls];
+  if (!bp) return NULL;
+  tc->head[cls] = FREE_NEXT(bp);
+  tc->count[cls]--;
+  return bp;
+}
+
+/*
+ * Give up to n cached blocks of a class back to the arenas that own them.
+ * Runs of blocks from the same arena share one lock acquisition.
+ */
+static void tcache_flush(ThreadCache* tc, size_t cls, unsigned n) {
+  HeapState* locked = NULL;
+  for (Header* bp; n-- && (bp = tcache_pop(tc, cls));) {
+    HeapState* owner = block_arena(bp);
+    if (owner != locked) {
+      if (locked) arena_unlock(locked);
+      arena_lock(owner);
+      locked = owner;
+    }
+    heap_free_block(owner, bp);
+  }
+  if (locked) arena_unlock(locked);
+}
+
+/* Thread exit: nothing may stay stranded in a dead thread's cache */
+static void tcache_thread_exit(void* arg) {
+  ThreadCache* tc = (ThreadCache*)arg;
+  for (size_t cls = 0; cls < TCACHE_CLASSES; cls++)
+    if (tc->count[cls]) tcache_flush(tc, cls, tc->count[cls]);
+
+  if (_thread_arena) {
+    __atomic_fetch_sub(&_thread_arena->stats.threads, 1, __ATOMIC_RELAXED);
+    _thread_arena = NULL;
+  }
+}
+
+static void tcache_key_init(void) {
+  pthread_key_create(&_tcache_key, tcache_thread_exit);
+}
+
+static void tcache_register(ThreadCache* tc) {
+  pthread_once(&_tcache_once, tcache_key_init);
+  pthread_setspecific(_tcache_key, tc);
+  tc->registered = 1;
+}
+
+/* Carve a batch of total_size blocks: return one, cache the rest */
+static Header* tcache_refill(ThreadCache* tc, size_t total_size) {
+  if (!tc->registered) tcache_register(tc);
+
+  HeapState* h = arena_lock_local();
+  Header* first = heap_alloc_block(h, total_size);
+  for (unsigned i = 1; first && i < HEAP_TCACHE_BATCH; i++) {
+    Header* bp = heap_alloc_block(h, total_size);
+    if (!bp) break;
+    /* a block that absorbed a split remainder can be past the last class */
+    if (!tcache_holds(BLOCK_BYTES(bp)) ||
+        tc->count[tcache_class(BLOCK_BYTES(bp))] >= HEAP_TCACHE_COUNT) {
+      heap_free_block(h, bp);
+      break;
+    }
+    tcache_push(tc, bp);
+  }
+  arena_unlock(h);
+
+  return first;
+}
+
+/* First allocation of a thread: arrange for its exit to be noticed */
+static void thread_register(void) {
+  if (!_tcache.registered) tcache_register(&_tcache);
+}
+
+#else
+
+static void thread_register(void) {}
+
+#endif /* HEAP_THREAD_SAFE */
+
+/* -------------------------------------------------------------------------- */
+/* Allocation                                                                 */
+/* -------------------------------------------------------------------------- */
+
+/* Block bytes needed for a size-byte payload, 0 (error set) if too large */
+static size_t block_total_size(size_t size) {
+  if (size > SIZE_MAX - SIZE_ALIGN_MASK) {
+    heap_set_error(HEAP_OVERFLOW, ENOMEM);
+    return 0;
+  }
+
+  size_t payload_size = (size + SIZE_ALIGN_MASK) & ~SIZE_ALIGN_MASK;
+  if (payload_size > SIZE_MAX - HEADER_SIZE_BYTES - 2 * FENCE_SIZE) {
+    heap_set_error(HEAP_OVERFLOW, ENOMEM);
+    return 0;
+  }
+
+  size_t total_size = HEADER_SIZE_BYTES + payload_size + 2 * FENCE_SIZE;
+  if (total_size < MIN_BLOCK_BYTES) total_size = MIN_BLOCK_BYTES;
+  if (total_size > MAX_HEAP_TOTAL_SIZE) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return 0;
+  }
+  return total_size;
+}
+
+/*
+ * Shared allocation path. With zero set the payload reads as zero: blocks
+ * known to be zero (fresh mmap pages) skip the memset, everything else,
+ * pooled blocks included, is cleared.
+ */
+static void* halloc_fill(size_t size, int zero) {
+  if (!heap_ready() || size == 0) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return NULL;
+  }
+  if (heap_spray_check(size) == HEAP_SPRAY_DETECTED) {
+    heap_set_error(HEAP_SPRAY_ATTACK, EACCES);
+    return NULL;
+  }
+
+  size_t total_size = block_total_size(size);
+  if (!total_size) return NULL;
+
+  if (total_size >= _mmap_threshold) {
+    Header* big = direct_alloc(total_size, 0);  /* pages arrive zeroed */
+    return big ? block_fence(big) : NULL;
+  }
+
+  /* the pools take the small sizes, the thread cache the ones just past */
+  void* pool_ptr = pool_alloc(size);
+  if (pool_ptr != NULL) {
+    if (zero) memset(pool_ptr, 0, size);
+    return pool_ptr;
+  }
+
+#if HEAP_THREAD_SAFE
+  int cached = tcache_holds(total_size);
+  if (cached) {
+    Header* hit = tcache_pop(&_tcache, tcache_class(total_size));
+    if (hit) return block_prepare(hit, zero);
+  }
+#endif
+
+  Header* p;
+#if HEAP_THREAD_SAFE
+  if (cached) {
+    p = tcache_refill(&_tcache, total_size);
+  } else
+#endif
+  {
+    HeapState* h = arena_lock_local();
+    p = heap_alloc_block(h, total_size);
+    arena_unlock(h);
+  }
+  if (!p) return NULL;
+
+  return block_prepare(p, zero);
+}
+
+void* halloc(size_t size) { return halloc_fill(size, 1); }
+
+/* For callers that overwrite the whole buffer: no zeroing at all */
+void* halloc_uninit(size_t size) { return halloc_fill(size, 0); }
+
+void* hcalloc(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) {
+    heap_set_error(HEAP_OVERFLOW, ENOMEM);
+    return NULL;
+  }
+  return halloc_fill(count * size, 1);
+}
+
+/* Batch allocation failed: give back the got blocks already handed out */
+static size_t halloc_batch_undo(void** out, size_t got) {
+  hfree_batch(out, got);
+  heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+  return 0;
+}
+
+/*
+ * Allocate n zeroed blocks of size bytes into out[], all or nothing: returns
+ * n, or 0 with nothing allocated. The spray check, the pools, the thread
+ * cache and the arena lock are each visited once for the whole batch, and
+ * whatever they cannot supply is carved from a single free span.
+ */
+size_t halloc_batch(size_t size, size_t n, void** out) {
+  if (!heap_ready() || size == 0) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return 0;
+  }
+  if (!out) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return 0;
+  }
+  if (heap_spray_check(size) == HEAP_SPRAY_DETECTED) {
+    heap_set_error(HEAP_SPRAY_ATTACK, EACCES);
+    return 0;
+  }
+
+  size_t total_size = block_total_size(size);
+  if (!total_size) return 0;
+
+  size_t got = 0;
+  if (total_size >= _mmap_threshold) {
+    for (; got < n; got++) {
+      Header* big = direct_alloc(total_size, 0);
+      if (!big) return halloc_batch_undo(out, got);
+      out[got] = block_fence(big);
+    }
+    return n;
+  }
+
+  for (size_t pooled = pool_alloc_batch(size, n, out); pooled; pooled--)
+    memset(out[got++], 0, size);
+
+#if HEAP_THREAD_SAFE
+  if (tcache_holds(total_size)) {
+    for (Header* hit;
+         got < n && (hit = tcache_pop(&_tcache, tcache_class(total_size)));)
+      out[got++] = block_prepare(hit, 1);
+  }
+#endif
+
+  if (got < n) {
+    size_t carved = n - got;
+    HeapState* h = arena_lock_local();
+    if (!heap_alloc_span(h, total_size, carved, out + got)) {
+      /* no span that large: fall back to one block at a time */
+      for (carved = 0; got + carved < n; carved++) {
+        Header* bp = heap_alloc_block(h, total_size);
+        if (!bp) break;
+        out[got + carved] = bp;
+      }
+    }
+    arena_unlock(h);
+
+    for (; carved; carved--, got++)
+      out[got] = block_prepare((Header*)out[got], 1);
+    if (got < n) return halloc_batch_undo(out, got);
+  }
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return n;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Aligned allocation                                                         */
+/* -------------------------------------------------------------------------- */
+
+void* haligned_alloc(size_t alignment, size_t size) {
+  if (!heap_ready() || size == 0) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return NULL;
+  }
+  if (alignment == 0 || (alignment & (alignment - 1))) {
+    heap_set_error(HEAP_ALIGNMENT_ERROR, EINVAL);
+    return NULL;
+  }
+
+  /* every payload, pooled or not, is already max_align_t aligned */
+  if (alignment <= alignof(max_align_t)) return halloc(size);
+
+  if (heap_spray_check(size) == HEAP_SPRAY_DETECTED) {
+    heap_set_error(HEAP_SPRAY_ATTACK, EACCES);
+    return NULL;
+  }
+
+  size_t total_size = block_total_size(size);
+  if (!total_size) return NULL;
+  if (total_size > MAX_HEAP_TOTAL_SIZE || alignment > MAX_HEAP_TOTAL_SIZE) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
+  }
+
+  if (total_size >= _mmap_threshold) {
+    Header* big = direct_alloc(total_size, alignment);
+    return big ? block_fence(big) : NULL;
+  }
+
+  HeapState* h = arena_lock_local();
+  Header* p = heap_alloc_aligned(h, total_size, alignment);
+  arena_unlock(h);
+  if (!p) return NULL;
+
+  return block_prepare(p, 1);
+}
+
+int hposix_memalign(void** memptr, size_t alignment, size_t size) {
+  if (!memptr || alignment < sizeof(void*) ||
+      (alignment & (alignment - 1))) {
+    heap_set_error(HEAP_ALIGNMENT_ERROR, EINVAL);
+    return EINVAL;
+  }
+
+  void* p = haligned_alloc(alignment, size);
+  if (!p) return heap_last_error() == HEAP_OUT_OF_MEMORY ? ENOMEM : EINVAL;
+
+  *memptr = p;
+  return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Free                                                                       */
+/* -------------------------------------------------------------------------- */
+
+#if HEAP_HARDENING == HEAP_HARDEN_NONE
+
+/* No checks: ptr is trusted to be a live payload of heap */
+static Header* block_from_payload(Heap* heap, void* ptr) {
+  (void)heap;
+  return PAYLOAD_HEADER(ptr);
+}
+
+#else
+
+/* Header of a live payload of heap, NULL (error set) if ptr is not one */
+static Header* block_from_payload(Heap* heap, void* ptr) {
+  if (!is_valid_heap_ptr(heap, ptr)) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return NULL;
+  }
+
+  Header* bp = PAYLOAD_HEADER(ptr);
+
+  if (!IS_INUSE(bp) || bp->Info.magic == HEAP_MAGIC_CACHED) {
+    heap_set_error(HEAP_DOUBLE_FREE, EINVAL);
+    return NULL;
+  }
+
+  if (bp->Info.magic != HEAP_MAGIC_ALLOC) {
+    heap_set_error(HEAP_CORRUPTION_DETECTED, EFAULT);
+    return NULL;
+  }
+
+#if HEAP_HARDENING >= HEAP_HARDEN_FULL
+  /* check fence */
+  uint8_t* pre_fence = (uint8_t*)ptr - FENCE_SIZE;
+  uint8_t* post_fence = (uint8_t*)ptr + BLOCK_PAYLOAD_BYTES(bp);
+
+  if (!check_fence(pre_fence) || !check_fence(post_fence)) {
+    heap_set_error(HEAP_BOUNDARY_ERROR, EFAULT);
+    return NULL;
+  }
+#endif
+  return bp;
+}
+
+/*
+ * Whether bp can be the block handed out for a size-byte request: the
+ * payload holds size, and an arena block is never bigger than an unsplit
+ * remainder would make it (direct blocks round up to pages).
+ */
+static int block_fits_size(Header* bp, size_t size) {
+  if (size > BLOCK_PAYLOAD_BYTES(bp)) return 0;
+  if (!block_arena(bp)) return 1;
+  return BLOCK_BYTES(bp) < block_total_size(size) + MIN_BLOCK_BYTES;
+}
+
+#endif /* HEAP_HARDENING */
+
+/* Hand a validated block back: direct unmap, thread cache or its arena */
+static void block_release(Header* freed_block) {
+  HeapState* owner = block_arena(freed_block);
+  if (!owner) {
+    direct_free(heap_segment_of(freed_block));
+    heap_set_error(HEAP_SUCCESS, 0);
+    return;
+  }
+
+#if HEAP_HARDENING >= HEAP_HARDEN_FULL
+  /* poison payload */
+  if (__atomic_load_n(&_poison_free, __ATOMIC_RELAXED))
+    memset(BLOCK_PAYLOAD(freed_block), 0xDE, BLOCK_PAYLOAD_BYTES(freed_block));
+#endif
+
+#if HEAP_THREAD_SAFE
+  /* instance blocks skip the thread cache, which serves the default heap */
+  if (!owner->owner && tcache_holds(BLOCK_BYTES(freed_block))) {
+    size_t cls = tcache_class(BLOCK_BYTES(freed_block));
+    if (!_tcache.registered) tcache_register(&_tcache);
+    if (_tcache.count[cls] >= HEAP_TCACHE_COUNT)
+      tcache_flush(&_tcache, cls, HEAP_TCACHE_BATCH);
+    tcache_push(&_tcache, freed_block);
+    heap_set_error(HEAP_SUCCESS, 0);
+    return;
+  }
+#endif
+
+  arena_lock(owner);
+  heap_free_block(owner, freed_block);
+  arena_unlock(owner);
+
+  heap_set_error(HEAP_SUCCESS, 0);
+}
+
+void hfree(void* ptr) {
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return;
+  }
+
+  if (!ptr) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return;
+  }
+
+  if (pool_free(ptr)) {
+    return;
+  }
+
+  Header* freed_block = block_from_payload(NULL, ptr);
+  if (!freed_block) return;
+
+  block_release(freed_block);
+}
+
+/* Usable payload bytes of a live allocation, 0 (error set) if ptr is not one */
+size_t heap_usable_size(void* ptr) {
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return 0;
+  }
+
+  if (!ptr) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return 0;
+  }
+
+  size_t bytes = pool_usable_size(ptr);
+  if (!bytes) {
+    Header* bp = block_from_payload(NULL, ptr);
+    if (!bp) return 0;
+    bytes = BLOCK_PAYLOAD_BYTES(bp);
+  }
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return bytes;
+}
+
+/*
+ * Free with the size the caller allocated: pools too small for size are
+ * skipped, larger sizes skip the pools altogether, and hardened builds check
+ * size against the header. Size 0 means unknown, as with hfree.
+ */
+void hfree_sized(void* ptr, size_t size) {
+  if (!size) {
+    hfree(ptr);
+    return;
+  }
+
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return;
+  }
+
+  if (!ptr) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return;
+  }
+
+  if (pool_free_sized(ptr, size)) return;
+
+  Header* freed_block = block_from_payload(NULL, ptr);
+  if (!freed_block) return;
+
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  if (!block_fits_size(freed_block, size)) {
+    heap_set_error(HEAP_INVALID_SIZE, EINVAL);
+    return;
+  }
+#endif
+
+  block_release(freed_block);
+}
+
+static int ptr_order(const void* a, const void* b) {
+  uintptr_t x = (uintptr_t)*(void* const*)a;
+  uintptr_t y = (uintptr_t)*(void* const*)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Free n payloads, sorting ptrs[] in place by address first. Blocks of the
+ * set that sit next to each other are merged while still in use and go back
+ * to the bins as one block, and each run of blocks from the same arena shares
+ * one lock acquisition. NULL entries are skipped, as are invalid pointers;
+ * the error of the first invalid one is kept.
+ */
+void hfree_batch(void** ptrs, size_t n) {
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return;
+  }
+  if (!ptrs) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return;
+  }
+
+  qsort(ptrs, n, sizeof(*ptrs), ptr_order);
+
+  HeapErrorCode err = HEAP_SUCCESS;
+  int err_no = 0;
+  HeapState* locked = NULL;
+  Header* run = NULL;  /* merged blocks of locked, still marked in use */
+  size_t merged = 0;   /* blocks absorbed into run */
+
+  for (size_t i = 0; i < n; i++) {
+    void* ptr = ptrs[i];
+    if (!ptr || pool_free(ptr)) continue;
+
+    /* the run ends at the first block that does not follow on from it */
+    if (run && (char*)run + BLOCK_BYTES(run) != (char*)PAYLOAD_HEADER(ptr)) {
+      locked->stats.frees += merged;
+      heap_free_block(locked, run);
+      run = NULL;
+    }
+
+    Header* bp = block_from_payload(NULL, ptr);
+    if (!bp) {
+      if (err == HEAP_SUCCESS) {
+        err = heap_last_error();
+        err_no = errno;
+      }
+      continue;
+    }
+
+    HeapState* owner = block_arena(bp);
+    if (!owner) {
+      direct_free(heap_segment_of(bp));
+      continue;
+    }
+
+#if HEAP_HARDENING >= HEAP_HARDEN_FULL
+    if (__atomic_load_n(&_poison_free, __ATOMIC_RELAXED))
+      memset(ptr, 0xDE, BLOCK_PAYLOAD_BYTES(bp));
+#endif
+
+    /* absorbed headers read as free, so freeing them again is caught */
+    if (run) {
+      CLEAR_INUSE(bp);
+      bp->Info.magic = HEAP_MAGIC_FREE;
+      SET_BLOCK_BYTES(run, BLOCK_BYTES(run) + BLOCK_BYTES(bp));
+      merged++;
+      continue;
+    }
+
+    if (owner != locked) {
+      if (locked) arena_unlock(locked);
+      arena_lock(owner);
+      locked = owner;
+    }
+    run = bp;
+    merged = 0;
+  }
+
+  if (run) {
+    locked->stats.frees += merged;
+    heap_free_block(locked, run);
+  }
+  if (locked) arena_unlock(locked);
+
+  heap_set_error(err, err_no);
+}
+
+/* -------------------------------------------------------------------------- */
+/* Reallocation                                                               */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * Resize bp to total_size bytes without copying: shrink by trimming the
+ * tail, grow by absorbing the following block if it is free and big enough.
+ * Direct blocks are remapped instead. Returns the block's (possibly new)
+ * header, NULL if the payload has to be copied elsewhere.
+ */
+static Header* block_resize(Header* bp, size_t total_size) {
+  Segment* seg = heap_segment_of(bp);
+  if (!seg->arena) return direct_resize(seg, total_size);
+
+  HeapState* h = seg->arena;
+  size_t old_bytes = BLOCK_BYTES(bp);
+  int ok = 1;
+
+  arena_lock(h);
+  if (total_size > old_bytes) {
+    Header* next = (Header*)((char*)bp + old_bytes);
+    if (!IS_INUSE(next) && old_bytes + BLOCK_BYTES(next) >= total_size) {
+      bin_remove(h, next);
+      SET_BLOCK_BYTES(bp, old_bytes + BLOCK_BYTES(next));
+      SET_PREV_INUSE((Header*)((char*)bp + BLOCK_BYTES(bp)));
+    } else {
+      ok = 0;
+    }
+  }
+  if (ok) {
+    block_trim(h, bp, total_size);
+    arena_in_use(h, BLOCK_BYTES(bp) - old_bytes);
+  }
+  arena_unlock(h);
+
+  return ok ? bp : NULL;
+}
+
+/* Move a payload of old_size usable bytes into a fresh size-byte block */
+static void* realloc_move(void* ptr, size_t old_size, size_t size) {
+  void* fresh = halloc_uninit(size);
+  if (!fresh) return NULL;
+
+  /* the copy covers the front; only the rest of the payload needs zeroing,
+     and a direct block's pages are zero already */
+  size_t kept = old_size < size ? old_size : size;
+  memcpy(fresh, ptr, kept);
+  size_t usable = pool_usable_size(fresh);
+  if (!usable) {
+    Header* bp = PAYLOAD_HEADER(fresh);
+    usable = block_arena(bp) ? BLOCK_PAYLOAD_BYTES(bp) : kept;
+  }
+  memset((uint8_t*)fresh + kept, 0, usable - kept);
+  hfree(ptr);
+  heap_set_error(HEAP_SUCCESS, 0);
+  return fresh;
+}
+
+void* hrealloc(void* ptr, size_t size) {
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return NULL;
+  }
+  if (!ptr) return halloc(size);
+  if (size == 0) {
+    hfree(ptr);
+    return NULL;
+  }
+
+  /* pooled blocks have a fixed size: keep them while the request fits */
+  size_t pool_size = pool_usable_size(ptr);
+  if (pool_size) {
+    /* a freed pooled block is refused, as pool_free would refuse it */
+    if (!pool_in_use(ptr)) {
+      heap_set_error(HEAP_DOUBLE_FREE, EINVAL);
+      return NULL;
+    }
+    if (size <= pool_size) {
+      heap_set_error(HEAP_SUCCESS, 0);
+      return ptr;
+    }
+    return realloc_move(ptr, pool_size, size);
+  }
+
+  Header* bp = block_from_payload(NULL, ptr);
+  if (!bp) return NULL;
+
+  size_t total_size = block_total_size(size);
+  if (!total_size) return NULL;
+
+  size_t old_payload = BLOCK_PAYLOAD_BYTES(bp);
+  Header* resized = block_resize(bp, total_size);
+  if (!resized) return realloc_move(ptr, old_payload, size);
+  ptr = BLOCK_PAYLOAD(resized);
+
+  /* new bytes start zeroed like a fresh halloc; the post fence moves */
+  size_t payload_size = BLOCK_PAYLOAD_BYTES(resized);
+  if (payload_size > old_payload) {
+    size_t dirty = payload_size - old_payload;
+    /* a remapped block only reuses its old fence and sentinel bytes */
+    if (!block_arena(resized) && dirty > FENCE_SIZE + HEADER_SIZE_BYTES)
+      dirty = FENCE_SIZE + HEADER_SIZE_BYTES;
+    memset((uint8_t*)ptr + old_payload, 0, dirty);
+  }
+  set_fence((uint8_t*)ptr + payload_size);
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return ptr;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Diagnostics                                                                */
+/* -------------------------------------------------------------------------- */
+
+/* First segment at or after arena a; direct segments follow the last arena */
+static Segment* first_segment_from(unsigned a) {
+  for (; a < _arena_count; a++)
+    if (_arenas[a].segments) return _arenas[a].segments;
+  return _direct;
+}
+
+/* Segment after seg in traversal order; an instance ends with its arena */
+static Segment* segment_after(const Segment* seg) {
+  if (seg->next || !seg->arena || seg->arena->owner) return seg->next;
+  return first_segment_from(seg->arena->index + 1);
+}
+
+void heap_walk_dump(void) {
+  if (!heap_ready()) {
+    printf("heap not initialized\n");
+    return;
+  }
+
+  printf("heap start=%p size=%zu arenas=%u\n", heap_start_addr(),
+         heap_total_size(), _arena_count);
+
+  size_t idx = 0;
+  for (Segment* seg = first_segment_from(0); seg; seg = segment_after(seg)) {
+    if (seg->arena)
+      printf("arena %u segment %p size=%zu\n", seg->arena->index, (void*)seg,
+             seg->size);
+    else
+      printf("direct segment %p size=%zu\n", (void*)seg, seg->size);
+
+    Header* p = seg->blocks;
+    while (p < seg->end) {
+      size_t total = BLOCK_BYTES(p);
+      uint8_t* pay = BLOCK_PAYLOAD(p);
+      uint8_t* pre = pay - FENCE_SIZE;
+      size_t psz = BLOCK_PAYLOAD_BYTES(p);
+      uint8_t* post = pay + psz;
+
+      printf(
+          "block %zu: hdr=%p payload=%p total=%zu payload=%zu inuse=%d "
+          "prev_inuse=%d magic=0x%08x fence(pre=%s post=%s)\n",
+          idx++, (void*)p, pay, total, psz, IS_INUSE(p), IS_PREV_INUSE(p),
+          p->Info.magic, check_fence(pre) ? "ok" : "bad",
+          check_fence(post) ? "ok" : "bad");
+
+      p = (Header*)((char*)p + total);
+    }
+  }
+}
+
+/* Print raw heap bytes (arena segments only; direct blocks are too big) */
+void heap_raw_dump(void) {
+  if (!heap_ready()) return;
+
+  for (Segment* seg = first_segment_from(0); seg && seg->arena;
+       seg = segment_after(seg)) {
+    uint8_t* p = (uint8_t*)seg->blocks;
+    uint8_t* end = (uint8_t*)seg->end;
+
+    size_t i = 0;
+    printf("\n            ");
+    for (; p < end; p++, i++) {
+      if (i && i % 32 == 0) printf("\n            ");
+      printf("%02x ", *p);
+    }
+    printf("\n");
+  }
+}
+
+void* heap_start_addr(void) {
+    Segment* seg = heap_ready() ? first_segment_from(0) : NULL;
+    return seg ? (void*)seg->blocks : NULL;
+}
+
+size_t heap_total_size(void) {
+    return __atomic_load_n(&_mapped_total, __ATOMIC_RELAXED);
+}
+
+Header* heap_first_block(void) {
+    if (!heap_ready()) return NULL;
+    Segment* seg = first_segment_from(0);
+    return seg ? seg->blocks : NULL;
+}
+
+Header* heap_next_block(Header* current) {
+    if (!current) return NULL;
+    Segment* seg = heap_segment_of(current);
+    if (!seg) return NULL;
+
+    Header* next = (Header*)((char*)current + BLOCK_BYTES(current));
+    if (next < seg->end) return next;
+
+    /* end of this segment's chain: continue with the next segment */
+    seg = segment_after(seg);
+    return seg ? seg->blocks : NULL;
+}
+
+/* Locks are always taken in arena order, so holding them all cannot deadlock */
+void heap_lock(void) {
+  for (unsigned a = 0; a < _arena_count; a++) heap_lock_acquire(&_arenas[a].lock);
+  heap_lock_acquire(&_direct_lock);
+}
+
+void heap_unlock(void) {
+  heap_lock_release(&_direct_lock);
+  for (unsigned a = _arena_count; a-- > 0;) heap_lock_release(&_arenas[a].lock);
+}
+
+Header* heap_first_block_in(Heap* h) {
+  if (!h) return heap_first_block();
+  return h->arena.segments ? h->arena.segments->blocks : NULL;
+}
+
+void heap_lock_in(Heap* h) {
+  if (h)
+    heap_lock_acquire(&h->arena.lock);
+  else
+    heap_lock();
+}
+
+void heap_unlock_in(Heap* h) {
+  if (h)
+    heap_lock_release(&h->arena.lock);
+  else
+    heap_unlock();
+}
+
+Heap* heap_owner_of(const void* ptr) {
+  Segment* seg = heap_segment_of(ptr);
+  return seg ? segment_owner(seg) : NULL;
+}
+
+GcRoots* heap_roots(Heap* h) { return h ? &h->roots : &_roots; }
+
+PoolSet* heap_pools(Heap* h) { return h ? &h->pools : pool_default_set(); }
+
+void heap_set_poison(int enabled) {
+  __atomic_store_n(&_poison_free, enabled != 0, __ATOMIC_RELAXED);
+}
+
+size_t heap_scavenge(unsigned decay_ms) {
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return 0;
+  }
+
+  size_t released = 0;
+  uint32_t now = heap_clock_ms();
+  for (unsigned a = 0; a < _arena_count; a++) {
+    arena_lock(&_arenas[a]);
+    released += arena_scavenge(&_arenas[a], now, decay_ms);
+    arena_unlock(&_arenas[a]);
+  }
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return released;
+}
+
+/* Snapshot of one arena's counters */
+static void arena_stats_copy(HeapState* h, HeapArenaStats* out) {
+  heap_lock_acquire(&h->lock);
+  out->mapped_bytes = h->stats.mapped_bytes;
+  out->segments = h->stats.segments;
+  out->allocs = h->stats.allocs;
+  out->frees = h->stats.frees;
+  out->bytes_in_use = h->stats.bytes_in_use;
+  out->peak_in_use = h->stats.peak_in_use;
+  out->free_bytes = h->stats.free_bytes;
+  out->free_blocks = h->stats.free_blocks;
+  out->largest_free = bin_largest(h);
+  out->scavenged_bytes = h->stats.scavenged_bytes;
+  out->hugetlb_bytes = h->stats.hugetlb_bytes;
+  out->thp_bytes = h->stats.thp_bytes;
+  heap_lock_release(&h->lock);
+
+  /* bumped outside the lock */
+  out->lock_contended =
+      __atomic_load_n(&h->stats.lock_contended, __ATOMIC_RELAXED);
+  out->threads = __atomic_load_n(&h->stats.threads, __ATOMIC_RELAXED);
+}
+
+unsigned heap_arena_count(void) { return heap_ready() ? _arena_count : 0; }
+
+HeapErrorCode heap_arena_stats(unsigned idx, HeapArenaStats* out) {
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return HEAP_NOT_INITIALIZED;
+  }
+  if (!out || idx >= _arena_count) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return HEAP_INVALID_POINTER;
+  }
+
+  arena_stats_copy(&_arenas[idx], out);
+  heap_set_error(HEAP_SUCCESS, 0);
+  return HEAP_SUCCESS;
+}
+
+void heap_arena_print_stats(void) {
+  HeapArenaStats st;
+  for (unsigned a = 0; a < heap_arena_count(); a++) {
+    if (heap_arena_stats(a, &st) != HEAP_SUCCESS) return;
+    printf("arena %u: mapped=%zu segments=%zu allocs=%zu frees=%zu "
+           "in_use=%zu peak=%zu free=%zu free_blocks=%zu largest=%zu "
+           "contended=%zu threads=%zu scavenged=%zu hugetlb=%zu thp=%zu\n",
+           a, st.mapped_bytes, st.segments, st.allocs, st.frees,
+           st.bytes_in_use, st.peak_in_use, st.free_bytes, st.free_blocks,
+           st.largest_free, st.lock_contended, st.threads,
+           st.scavenged_bytes, st.hugetlb_bytes, st.thp_bytes);
+  }
+}
+
+/* -------------------------------------------------------------------------- */
+/* Heap instances                                                             */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * An instance is a private heap: one arena with its own segments, a pool set
+ * and a GC root table, all reached from the Heap struct (mapped on its own).
+ * Its arena is never handed to threads, its blocks bypass the thread caches,
+ * and large blocks stay in its segments instead of being mapped directly, so
+ * everything it owns is found from the struct and unmapped in one pass.
+ */
+static size_t instance_bytes(void) {
+  return align_to_pages(sizeof(Heap), page_bytes());
+}
+
+Heap* heap_create(const HeapConfig* cfg) {
+  if (!cfg) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return NULL;
+  }
+
+  Heap* h = mmap(NULL, instance_bytes(), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (h == MAP_FAILED) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
+  }
+
+  arena_init(&h->arena, 0, cfg);
+  h->arena.owner = h;
+  if (arena_first_segment(&h->arena, cfg) != HEAP_SUCCESS) {
+    munmap(h, instance_bytes());
+    return NULL;
+  }
+  pool_set_init(&h->pools, cfg->huge_pages != 0);
+  heap_lock_init(&h->roots.lock);
+
+  heap_lock_acquire(&_init_lock);
+  h->next = _instances;
+  if (_instances) _instances->prev = h;
+  _instances = h;
+  fork_handlers_install();
+  heap_lock_release(&_init_lock);
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return h;
+}
+
+void* heap_alloc(Heap* h, size_t size) {
+  if (!h) return halloc(size);
+  if (size == 0) {
+    heap_set_error(HEAP_INVALID_SIZE, EINVAL);
+    return NULL;
+  }
+  if (heap_spray_check(size) == HEAP_SPRAY_DETECTED) {
+    heap_set_error(HEAP_SPRAY_ATTACK, EACCES);
+    return NULL;
+  }
+
+  size_t total_size = block_total_size(size);
+  if (!total_size) return NULL;
+
+  void* pool_ptr = pool_set_alloc(&h->pools, size);
+  if (pool_ptr) {
+    memset(pool_ptr, 0, size);
+    return pool_ptr;
+  }
+
+  arena_lock(&h->arena);
+  Header* p = heap_alloc_block(&h->arena, total_size);
+  arena_unlock(&h->arena);
+  if (!p) return NULL;
+
+  return block_prepare(p, 1);
+}
+
+void heap_free(Heap* h, void* ptr) {
+  if (!h) {
+    hfree(ptr);
+    return;
+  }
+  if (!ptr) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return;
+  }
+
+  if (pool_set_free(&h->pools, ptr)) return;
+
+  /* a block of another heap is an invalid pointer here */
+  Header* freed_block = block_from_payload(h, ptr);
+  if (!freed_block) return;
+
+  block_release(freed_block);
+}
+
+/* Unmap the pools, every segment and the instance itself */
+void heap_destroy(Heap* h) {
+  if (!h) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return;
+  }
+
+  heap_lock_acquire(&_init_lock);
+  if (h->prev) h->prev->next = h->next;
+  else _instances = h->next;
+  if (h->next) h->next->prev = h->prev;
+  heap_lock_release(&_init_lock);
+
+  pool_set_destroy(&h->pools);
+  for (Segment* seg = h->arena.segments; seg;) {
+    Segment* next = seg->next;
+    release_mapped(seg->size);
+    segment_destroy(seg);
+    seg = next;
+  }
+  munmap(h, instance_bytes());
+
+  heap_set_error(HEAP_SUCCESS, 0);
+}
+
+HeapErrorCode heap_instance_stats(Heap* h, HeapArenaStats* out) {
+  if (!out) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return HEAP_INVALID_POINTER;
+  }
+  if (h) {
+    arena_stats_copy(&h->arena, out);
+    heap_set_error(HEAP_SUCCESS, 0);
+    return HEAP_SUCCESS;
+  }
+  if (!heap_ready()) {
+    heap_set_error(HEAP_NOT_INITIALIZED, EINVAL);
+    return HEAP_NOT_INITIALIZED;
+  }
+
+  memset(out, 0, sizeof(*out));
+  for (unsigned a = 0; a < _arena_count; a++) {
+    HeapArenaStats st;
+    arena_stats_copy(&_arenas[a], &st);
+    out->mapped_bytes += st.mapped_bytes;
+    out->segments += st.segments;
+    out->allocs += st.allocs;
+    out->frees += st.frees;
+    out->bytes_in_use += st.bytes_in_use;
+    out->free_bytes += st.free_bytes;
+    out->free_blocks += st.free_blocks;
+    if (st.largest_free > out->largest_free)
+      out->largest_free = st.largest_free;
+    out->lock_contended += st.lock_contended;
+    out->threads += st.threads;
+    out->scavenged_bytes += st.scavenged_bytes;
+    out->hugetlb_bytes += st.hugetlb_bytes;
+    out->thp_bytes += st.thp_bytes;
+  }
+  out->peak_in_use = __atomic_load_n(&_peak_total, __ATOMIC_RELAXED);
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return HEAP_SUCCESS;
+}
+
+HeapErrorCode heap_get_stats(HeapStats* out) {
+  HeapArenaStats st;
+  if (!out) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return HEAP_INVALID_POINTER;
+  }
+  HeapErrorCode res = heap_instance_stats(NULL, &st);
+  if (res != HEAP_SUCCESS) return res;
+
+  out->bytes_in_use = st.bytes_in_use;
+  out->peak_in_use = st.peak_in_use;
+  out->free_bytes = st.free_bytes;
+  out->free_blocks = st.free_blocks;
+  out->largest_free = st.largest_free;
+  out->fragmentation =
+      st.free_bytes ? 1.0 - (double)st.largest_free / (double)st.free_bytes
+                    : 0.0;
+  out->mapped_bytes = st.mapped_bytes;
+  out->allocs = st.allocs;
+  out->frees = st.frees;
+
+  heap_lock_acquire(&_direct_lock);
+  out->direct_blocks = _direct_blocks;
+  out->direct_bytes = _direct_bytes;
+  heap_lock_release(&_direct_lock);
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return HEAP_SUCCESS;
 }
@@ -2,7 +2,8 @@
 
 #include "heap_errors.h"
 
-static HeapErrorCode _heap_last_error = HEAP_SUCCESS;
+/* Last error of the calling thread */
+static _Thread_local HeapErrorCode _heap_last_error = HEAP_SUCCESS;
 
 /* Convert error code to string */
 const char* heap_error_what(HeapErrorCode code) {
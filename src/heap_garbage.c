@@ -4,24 +4,27 @@
 #include "heap_garbage.h"
 #include "heap.h"
 #include "heap_internal.h"
-
-#define MAX_ROOTS 1024
-
-static void** roots[MAX_ROOTS] = {0};
-static int num_roots = 0;
-
-/* Conservative check: is this pointer a valid payload pointer inside the heap */
-static int is_heap_payload_ptr(const void* ptr) {
+#include "heap_lock.h"
+#include "heap_segment.h"
+
+/*
+ * Every heap (the default one and each instance) has its own root table and
+ * is collected on its own: marking never follows a pointer into another
+ * heap, whose blocks are guarded by another lock. A heap's pooled blocks are
+ * traced like its other blocks, so whatever they point to stays alive, but
+ * they are never swept.
+ */
+
+/* Conservative check: is this pointer a valid payload pointer inside heap */
+static int is_heap_payload_ptr(Heap* heap, const void* ptr) {
     if (!ptr) return 0;
 
-    void* heap_start = heap_start_addr();
-    size_t heap_size = heap_total_size();
-
-    if (!heap_start || heap_size == 0) return 0;
+    Segment* seg = heap_segment_of(ptr);
+    if (!seg || heap_owner_of(ptr) != heap) return 0;
 
     uintptr_t p = (uintptr_t)ptr;
-    uintptr_t start = (uintptr_t)heap_start;
-    uintptr_t end = start + heap_size;
+    uintptr_t start = (uintptr_t)seg->blocks;
+    uintptr_t end = (uintptr_t)seg->end;
 
     if (p < start + HEADER_SIZE_BYTES + FENCE_SIZE || p >= end) return 0;
 
@@ -30,49 +33,50 @@ static int is_heap_payload_ptr(const void* ptr) {
     return 1;
 }
 
+static void scan(Heap* heap, const void* payload, size_t payload_bytes);
+
 /* Recursively mark reachable blocks starting from a header */
-static void mark(Header* bp) {
+static void mark(Heap* heap, Header* bp) {
     if (!bp || !IS_INUSE(bp) || bp->Info.magic != HEAP_MAGIC_ALLOC) return;
     if (IS_MARKED(bp)) return;
 
     SET_MARK(bp);
+    scan(heap, BLOCK_PAYLOAD(bp), BLOCK_PAYLOAD_BYTES(bp));
+}
+
+/* Mark what ptr points to: a heap block or a pooled one */
+static void mark_ptr(Heap* heap, void* ptr) {
+    if (is_heap_payload_ptr(heap, ptr)) {
+        mark(heap, PAYLOAD_HEADER(ptr));
+        return;
+    }
 
-    size_t total_bytes = BLOCK_BYTES(bp);
-    size_t payload_bytes = total_bytes - HEADER_SIZE_BYTES - 2 * FENCE_SIZE;
-    uint8_t* payload = (uint8_t*)(bp + 1) + FENCE_SIZE;
+    size_t pooled = pool_set_gc_mark(heap_pools(heap), ptr);
+    if (pooled) scan(heap, ptr, pooled);
+}
 
+/* Mark everything a payload's words point to */
+static void scan(Heap* heap, const void* payload, size_t payload_bytes) {
     size_t num_words = payload_bytes / sizeof(uintptr_t);
-    uintptr_t* words = (uintptr_t*)payload;
+    const uintptr_t* words = (const uintptr_t*)payload;
 
-    for (size_t i = 0; i < num_words; ++i) {
-        void* candidate = (void*)words[i];
-        if (is_heap_payload_ptr(candidate)) {
-            Header* child = (Header*)((uint8_t*)candidate - FENCE_SIZE) - 1;
-            mark(child);
-        }
-    }
+    for (size_t i = 0; i < num_words; ++i) mark_ptr(heap, (void*)words[i]);
 }
 
 /* Mark phase: mark all reachable blocks starting from registered roots */
-static void mark_phase(void) {
-    for (int i = 0; i < num_roots; ++i) {
-        void* ptr = *roots[i];
-        if (is_heap_payload_ptr(ptr)) {
-            Header* h = (Header*)((uint8_t*)ptr - FENCE_SIZE) - 1;
-            mark(h);
-        }
-    }
+static void mark_phase(Heap* heap, GcRoots* r) {
+    for (int i = 0; i < r->count; ++i) mark_ptr(heap, *r->roots[i]);
 }
 
 /* Sweep phase: free all unmarked blocks and clear marks on marked blocks */
-static void sweep_phase(void) {
-    Header* bp = heap_first_block();
+static void sweep_phase(Heap* heap) {
+    Header* bp = heap_first_block_in(heap);
     while (bp) {
         Header* next = heap_next_block(bp);
 
         if (IS_INUSE(bp) && bp->Info.magic == HEAP_MAGIC_ALLOC && !IS_MARKED(bp)) {
-            void* payload = (uint8_t*)(bp + 1) + FENCE_SIZE;
-            hfree(payload);
+            void* payload = BLOCK_PAYLOAD(bp);
+            heap_free(heap, payload);
         } else if (IS_INUSE(bp) && IS_MARKED(bp)) {
             CLEAR_MARK(bp);
         }
@@ -82,33 +86,57 @@ static void sweep_phase(void) {
 }
 
 /* Public API */
-void gc_add_root(void** root) {
-    if (root && num_roots < MAX_ROOTS) {
-        roots[num_roots++] = root;
+void heap_gc_add_root(Heap* h, void** root) {
+    GcRoots* r = heap_roots(h);
+    heap_lock_acquire(&r->lock);
+    if (root && r->count < MAX_ROOTS) {
+        r->roots[r->count++] = root;
     }
+    heap_lock_release(&r->lock);
 }
 
-void gc_remove_root(void** root) {
-    for (int i = 0; i < num_roots; ++i) {
-        if (roots[i] == root) {
-            roots[i] = roots[--num_roots];
-            roots[num_roots] = NULL;
+void heap_gc_remove_root(Heap* h, void** root) {
+    GcRoots* r = heap_roots(h);
+    heap_lock_acquire(&r->lock);
+    for (int i = 0; i < r->count; ++i) {
+        if (r->roots[i] == root) {
+            r->roots[i] = r->roots[--r->count];
+            r->roots[r->count] = NULL;
             break;
         }
     }
+    heap_lock_release(&r->lock);
 }
 
-/* Run full mark-and-sweep */
-void gc_collect(void) {
-    if (heap_total_size() == 0) return; /* heap not initialized */
+/*
+ * Run full mark-and-sweep over one heap. Its lock keeps the block chains
+ * stable for the whole cycle; other threads must not hide pointers while it
+ * runs.
+ */
+void heap_gc_collect(Heap* h) {
+    if (!h && heap_total_size() == 0) return; /* heap not initialized */
+
+    GcRoots* r = heap_roots(h);
+    heap_lock_in(h);
+    heap_lock_acquire(&r->lock);
 
     /* Clear all marks first */
-    Header* bp = heap_first_block();
+    Header* bp = heap_first_block_in(h);
     while (bp) {
         CLEAR_MARK(bp);
         bp = heap_next_block(bp);
     }
+    pool_set_gc_clear(heap_pools(h));
 
-    mark_phase();
-    sweep_phase();
+    mark_phase(h, r);
+    sweep_phase(h);
+
+    heap_lock_release(&r->lock);
+    heap_unlock_in(h);
 }
+
+void gc_add_root(void** root) { heap_gc_add_root(NULL, root); }
+
+void gc_remove_root(void** root) { heap_gc_remove_root(NULL, root); }
+
+void gc_collect(void) { heap_gc_collect(NULL); }
@@ -1,7 +1,9 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
+#include <limits.h>
 #include <stdalign.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -9,6 +11,8 @@
 
 #include "heap_pool.h"
 #include "heap_errors.h"
+#include "heap_lock.h"
+#include "heap_segment.h"
 
 
 
@@ -16,166 +20,929 @@
 #define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((a) - 1))
 #define PAYLOAD_OFFSET ALIGN_UP(sizeof(PoolBlock), alignof(max_align_t))
 
-static const size_t pool_sizes[NUM_POOLS] = {64, 128, 256, 1024};
-static MemoryPool _pools[NUM_POOLS];
+#define POOL_SUBDIV (1u << HEAP_POOL_SUB_BITS)
+#define POOL_MAX_PAYLOAD (((size_t)1 << HEAP_POOL_MAX_SHIFT) - PAYLOAD_OFFSET)
 
-/* Initialize all memory pools */
-void init_pools(void) {
+_Static_assert((HEAP_POOL_QUANTUM & (HEAP_POOL_QUANTUM - 1)) == 0 &&
+                   HEAP_POOL_QUANTUM >= PAYLOAD_OFFSET,
+               "pool quantum must be a power of two holding a block header");
+_Static_assert(HEAP_POOL_SMALL_SHIFT >= HEAP_POOL_SUB_BITS &&
+                   ((1u << HEAP_POOL_SMALL_SHIFT) >> HEAP_POOL_SUB_BITS) %
+                           HEAP_POOL_QUANTUM ==
+                       0,
+               "log-spaced pool classes must be quantum multiples");
+_Static_assert(HEAP_POOL_MAX_SHIFT >= HEAP_POOL_SMALL_SHIFT,
+               "largest pool class below the linear range");
+
+/* Block bytes of class i */
+static size_t pool_class_size(size_t i) {
+  if (i < POOL_SMALL_CLASSES) return (i + 2u) * HEAP_POOL_QUANTUM;
+
+  size_t lg = HEAP_POOL_SMALL_SHIFT + (i - POOL_SMALL_CLASSES) / POOL_SUBDIV;
+  size_t sub = (i - POOL_SMALL_CLASSES) % POOL_SUBDIV;
+  size_t step = (size_t)1 << (lg - HEAP_POOL_SUB_BITS);
+  return ((size_t)1 << lg) + (sub + 1u) * step;
+}
+
+/* Smallest class whose payload holds size bytes, -1 if none does */
+static int pool_class_of(size_t size) {
+  if (size > POOL_MAX_PAYLOAD) return -1;
+
+  size_t bytes = size + PAYLOAD_OFFSET;
+  if (bytes <= (size_t)1 << HEAP_POOL_SMALL_SHIFT) {
+    size_t steps = (bytes + HEAP_POOL_QUANTUM - 1u) / HEAP_POOL_QUANTUM;
+    return steps < 2u ? 0 : (int)(steps - 2u);
+  }
+
+  /* 2^lg < bytes <= 2^(lg+1); the next bits pick the step inside */
+  unsigned lg = (unsigned)(sizeof(unsigned long long) * CHAR_BIT - 1 -
+                           (unsigned)__builtin_clzll(bytes - 1u));
+  size_t sub = ((bytes - 1u) >> (lg - HEAP_POOL_SUB_BITS)) & (POOL_SUBDIV - 1u);
+  return (int)(POOL_SMALL_CLASSES +
+               (lg - HEAP_POOL_SMALL_SHIFT) * POOL_SUBDIV + sub);
+}
+
+/* The default heap's pools; heap instances bring their own set */
+static PoolSet _pools;
+
+static char* slab_blocks(PoolSlab* s) {
+  return (char*)s + s->pool->slab_header_bytes;
+}
+
+/*
+ * Slab map: a two-level radix table from POOL_SLAB_BYTES granule to the pool
+ * whose slab covers it (a huge page slab covers many granules), laid out like
+ * the segment map. Whether a pointer is pooled, and in which class, is then
+ * two loads whatever the slab count. Lookups are lock-free and never touch
+ * slab memory, which may be unmapped under them; entries are written by the
+ * class lock holder with release ordering.
+ */
+#define SLABMAP_BITS (HEAP_ADDR_BITS - POOL_SLAB_SHIFT)
+#define SLABMAP_ROOT_BITS (SLABMAP_BITS / 2u)
+#define SLABMAP_LEAF_BITS (SLABMAP_BITS - SLABMAP_ROOT_BITS)
+#define SLABMAP_LEAF_SIZE ((size_t)1 << SLABMAP_LEAF_BITS)
+
+static MemoryPool** _slabmap[(size_t)1 << SLABMAP_ROOT_BITS];
+
+/* Leaf slot for a granule key, allocating the leaf if asked to */
+static MemoryPool** slabmap_slot(uintptr_t key, int create) {
+  MemoryPool*** root = &_slabmap[key >> SLABMAP_LEAF_BITS];
+  MemoryPool** leaf = __atomic_load_n(root, __ATOMIC_ACQUIRE);
+
+  if (!leaf) {
+    if (!create) return NULL;
+    size_t bytes = SLABMAP_LEAF_SIZE * sizeof(MemoryPool*);
+    void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    /* classes have separate locks: another one may install the leaf first */
+    if (!__atomic_compare_exchange_n(root, &leaf, (MemoryPool**)mem, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      munmap(mem, bytes);
+    else
+      leaf = (MemoryPool**)mem;
+  }
+
+  return &leaf[key & (SLABMAP_LEAF_SIZE - 1)];
+}
+
+/* Point every granule of slab s at its pool (or at NULL with clear set) */
+static int slabmap_set(PoolSlab* s, MemoryPool* pool, int clear) {
+  uintptr_t first = (uintptr_t)s >> POOL_SLAB_SHIFT;
+  uintptr_t last = ((uintptr_t)s + pool->slab_bytes - 1) >> POOL_SLAB_SHIFT;
+  if (last >> SLABMAP_BITS) return 0;
+
+  for (uintptr_t key = first; key <= last; key++) {
+    MemoryPool** slot = slabmap_slot(key, !clear);
+    if (slot)
+      __atomic_store_n(slot, clear ? NULL : pool, __ATOMIC_RELEASE);
+    else if (!clear)
+      return 0;
+  }
+  return 1;
+}
+
+/* Pool whose slab covers ptr, NULL if ptr is not inside a slab */
+static MemoryPool* slabmap_get(const void* ptr) {
+  uintptr_t key = (uintptr_t)ptr >> POOL_SLAB_SHIFT;
+  if (key >> SLABMAP_BITS) return NULL;
+
+  MemoryPool** leaf =
+      __atomic_load_n(&_slabmap[key >> SLABMAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+  if (!leaf) return NULL;
+  return __atomic_load_n(&leaf[key & (SLABMAP_LEAF_SIZE - 1)],
+                         __ATOMIC_ACQUIRE);
+}
+
+/* Size a pool's slabs: header and allocation bitmap, then as many blocks */
+static void pool_layout(MemoryPool* pool) {
+  size_t room = pool->slab_bytes - sizeof(PoolSlab);
+  /* every block also costs two bits, and the bitmaps round up to words */
+  size_t blocks = room * 8u / (pool->block_size * 8u + 2u);
+  size_t header;
+  for (;;) {
+    header = ALIGN_UP(sizeof(PoolSlab) + 2u * ((blocks + 63u) / 64u * 8u),
+                      alignof(max_align_t));
+    if (header + blocks * pool->block_size <= pool->slab_bytes) break;
+    blocks--;
+  }
+  pool->slab_header_bytes = header;
+  pool->slab_blocks = blocks;
+  pool->map_words = (blocks + 63u) / 64u;
+}
+
+/*
+ * Initialize all memory pools of a set. No memory is mapped yet: each pool
+ * maps its first slab on first use. With huge_pages, slabs are one huge page.
+ */
+void pool_set_init(PoolSet* set, int huge_pages) {
   for (int i = 0; i < NUM_POOLS; i++) {
-    size_t bsize = pool_sizes[i];
+    size_t bsize = pool_class_size((size_t)i);
+    MemoryPool* pool = &set->pools[i];
+    heap_lock_init(&set->locks[i]);
+    memset(pool, 0, sizeof(*pool));
 
     /* Block must fit header + aligned payload */
     if (bsize < PAYLOAD_OFFSET) {
       heap_set_error(HEAP_INVALID_SIZE, EINVAL);
-      _pools[i].pool_mem = NULL;
       continue;
     }
 
-    size_t total_size = bsize * POOL_BLOCKS_PER_SIZE;
+    pool->block_size = bsize;
+    pool->huge_pages = huge_pages != 0;
+    pool->slab_bytes = huge_pages ? HEAP_HUGE_PAGE_BYTES : POOL_SLAB_BYTES;
+    pool_layout(pool);
+  }
 
-    void* mem = mmap(NULL, total_size, PROT_READ | PROT_WRITE,
-                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  heap_set_error(HEAP_SUCCESS, 0);
+}
 
-    if (mem == MAP_FAILED) {
-      heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
-      fprintf(stderr, "pool[%d] size=%zu: %s\n", i, bsize,
-              heap_error_what(heap_last_error()));
-      fprintf(stderr, "pool[%d] size=%zu: out of memory (errno=%d: %s)\n", i,
-              bsize, errno, strerror(errno));
-
-      _pools[i].pool_mem = NULL;
-      _pools[i].free_list = NULL;
-      _pools[i].total_blocks = 0;
-      _pools[i].used_blocks = 0;
-      _pools[i].free_blocks = 0;
-      _pools[i].peak_used = 0;
-      _pools[i].alloc_requests = 0;
-      _pools[i].free_requests = 0;
-      _pools[i].alloc_failures = 0;
-      continue;
-    }
+void init_pools(int huge_pages) { pool_set_init(&_pools, huge_pages); }
 
-    _pools[i].block_size = bsize;
-    _pools[i].pool_mem = mem;
-    _pools[i].total_blocks = POOL_BLOCKS_PER_SIZE;
+PoolSet* pool_default_set(void) { return &_pools; }
 
-    /* Build free list */
-    PoolBlock* head = (PoolBlock*)mem;
-    _pools[i].free_list = head;
-    PoolBlock* current = head;
+/* Unlink a slab from the list at *head */
+static void slab_unlink(PoolSlab** head, PoolSlab* s) {
+  if (s->prev) s->prev->next = s->next;
+  else *head = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
 
-    for (size_t j = 1; j < POOL_BLOCKS_PER_SIZE; j++) {
-      PoolBlock* next = (PoolBlock*)((char*)mem + j * bsize);
-      current->next = next;
-      current = next;
-    }
-    current->next = NULL;
+static void slab_push(PoolSlab** head, PoolSlab* s) {
+  s->prev = NULL;
+  s->next = *head;
+  if (*head) (*head)->prev = s;
+  *head = s;
+}
+
+/* Build a slab's free list over all of its blocks */
+static void slab_fill(MemoryPool* pool, PoolSlab* s) {
+  size_t blocks = pool->slab_blocks;
+  s->total_blocks = blocks;
+  s->used_blocks = 0;
+  s->peak_used = 0;
+  /* a retired slab may come back with stale marks */
+  memset(s->used_map + pool->map_words, 0, pool->map_words * 8u);
 
-    _pools[i].used_blocks = 0;
-    _pools[i].free_blocks = POOL_BLOCKS_PER_SIZE;
-    _pools[i].peak_used = 0;
-    _pools[i].alloc_requests = 0;
-    _pools[i].free_requests = 0;
-    _pools[i].alloc_failures = 0;
+  char* first = slab_blocks(s);
+  PoolBlock* current = (PoolBlock*)first;
+  s->free_list = current;
+  for (size_t j = 1; j < blocks; j++) {
+    PoolBlock* next = (PoolBlock*)(first + j * pool->block_size);
+    current->next = next;
+    current = next;
   }
+  current->next = NULL;
 
-  heap_set_error(HEAP_SUCCESS, 0);
+  slab_push(&pool->partial, s);
+  pool->slabs++;
+  pool->empty_slabs++;
+  pool->total_blocks += blocks;
 }
 
-/* Allocate from suitable pool */
-void* pool_alloc(size_t size) {
+/*
+ * Give a pool another slab, a retired one if there is one, and put it on the
+ * partial list (lock held)
+ */
+static PoolSlab* slab_new(MemoryPool* pool) {
+  PoolSlab* s = pool->retired;
+  if (s) {
+    pool->retired = s->next;
+    slab_fill(pool, s);
+    return s;
+  }
+
+  unsigned pages;
+  s = (PoolSlab*)segment_map(pool->slab_bytes, pool->slab_bytes,
+                             pool->huge_pages, &pages);
+  if (s && !slabmap_set(s, pool, 0)) {
+    slabmap_set(s, pool, 1);
+    munmap(s, pool->slab_bytes);
+    s = NULL;
+  }
+  if (!s) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
+  }
+
+  /* fresh pages: the allocation bitmap starts out clear */
+  s->pool = pool;
+  s->pages = pages;
+  slab_fill(pool, s);
+  return s;
+}
+
+/*
+ * Retire an empty slab (lock held): its pages past the header go back to the
+ * OS, but the range stays mapped and in the slab map. Lock-free paths may
+ * still read a block of it (a free-stack pop that lost its race, a stale
+ * free), which must not fault; with its bitmap clear, a stale free is then
+ * reported as a double free.
+ */
+static void slab_retire(MemoryPool* pool, PoolSlab* s) {
+  slab_unlink(&pool->partial, s);
+  pool->slabs--;
+  pool->empty_slabs--;
+  pool->total_blocks -= s->total_blocks;
+
+  long ps = sysconf(_SC_PAGESIZE);
+  size_t keep = ALIGN_UP(pool->slab_header_bytes, ps > 0 ? (size_t)ps : 4096u);
+  if (keep < pool->slab_bytes)
+    segment_decommit((char*)s + keep, pool->slab_bytes - keep);
+
+  s->next = pool->retired;
+  pool->retired = s;
+}
+
+static void slab_list_unmap(PoolSlab* s, MemoryPool* pool) {
+  while (s) {
+    PoolSlab* next = s->next;
+    slabmap_set(s, pool, 1);
+    munmap(s, pool->slab_bytes);
+    s = next;
+  }
+}
+
+static PoolSlab* slab_of_block(MemoryPool* pool, const PoolBlock* block) {
+  return (PoolSlab*)((uintptr_t)block & ~(uintptr_t)(pool->slab_bytes - 1));
+}
+
+/* Allocation bit of a block */
+static size_t slab_block_index(MemoryPool* pool, const PoolBlock* block) {
+  const char* first =
+      (const char*)slab_of_block(pool, block) + pool->slab_header_bytes;
+  return (size_t)((const char*)block - first) / pool->block_size;
+}
+
+#define USED_BIT(i) ((uint64_t)1 << ((i) % 64u))
+
+/* Unmap every slab of a set */
+void pool_set_destroy(PoolSet* set) {
   for (int i = 0; i < NUM_POOLS; i++) {
-    MemoryPool* pool = &_pools[i];
+    MemoryPool* pool = &set->pools[i];
+    slab_list_unmap(pool->partial, pool);
+    slab_list_unmap(pool->full, pool);
+    slab_list_unmap(pool->retired, pool);
+    pool->partial = pool->full = pool->retired = NULL;
+    pool->free_head = 0;
+    pool->slabs = pool->empty_slabs = 0;
+    pool->total_blocks = pool->used_blocks = 0;
+  }
+}
 
-    if (!pool->pool_mem) continue;
+/*
+ * Free stack: a Treiber stack of blocks in front of the slabs, so pool_alloc
+ * and pool_free of a warm class take no lock. The head packs the top block's
+ * address (below 2^HEAP_ADDR_BITS, slab map checked, and 16-byte aligned, so
+ * stored without its low bits) with a tag in the high bits that every push
+ * and pop bumps: a pop that read a stale top and next fails its CAS instead
+ * of installing them (ABA), unless the tag wrapped all the way round in
+ * between. That takes 2^20 operations while one thread sits between its load
+ * and its CAS. Blocks on the stack still count as taken for their slab, which
+ * therefore stays mapped; `next` and `depth` sit in the block header, which
+ * callers never write.
+ */
+#define STACK_ALIGN_SHIFT 4u
+#define STACK_ADDR_BITS (HEAP_ADDR_BITS - STACK_ALIGN_SHIFT)
+#define STACK_ADDR_MASK (((uint64_t)1 << STACK_ADDR_BITS) - 1u)
+#define STACK_TAG_ONE ((uint64_t)1 << STACK_ADDR_BITS)
 
-    /* Payload size check */
-    if (size > pool->block_size - PAYLOAD_OFFSET) continue;
+/* slab headers and block sizes keep every block on a 16-byte boundary */
+_Static_assert(alignof(max_align_t) >= (1u << STACK_ALIGN_SHIFT) &&
+                   HEAP_POOL_QUANTUM >= (1u << STACK_ALIGN_SHIFT),
+               "pool blocks must be 16-byte aligned for the free stack");
 
-    pool->alloc_requests++;
+static PoolBlock* stack_top(uint64_t head) {
+  return (PoolBlock*)(uintptr_t)((head & STACK_ADDR_MASK)
+                                 << STACK_ALIGN_SHIFT);
+}
 
-    if (pool->free_list == NULL) {
-      pool->alloc_failures++;
-      continue;
-    }
+static uint64_t stack_head(PoolBlock* top, uint64_t old) {
+  return ((uint64_t)(uintptr_t)top >> STACK_ALIGN_SHIFT) |
+         ((old & ~STACK_ADDR_MASK) + STACK_TAG_ONE);
+}
 
-    PoolBlock* block = pool->free_list;
-    pool->free_list = block->next;
+static int stack_push(MemoryPool* pool, PoolBlock* block) {
+  uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+  uint64_t next;
+  do {
+    PoolBlock* top = stack_top(head);
+    size_t depth = top ? __atomic_load_n(&top->depth, __ATOMIC_RELAXED) + 1 : 0;
+    /* beyond one slab's worth, blocks go back to their slab for retiring */
+    if (depth >= pool->slab_blocks) return 0;
+    __atomic_store_n(&block->next, top, __ATOMIC_RELAXED);
+    __atomic_store_n(&block->depth, depth, __ATOMIC_RELAXED);
+    next = stack_head(block, head);
+  } while (!__atomic_compare_exchange_n(&pool->free_head, &head, next, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return 1;
+}
 
-    pool->used_blocks++;
-    pool->free_blocks--;
+static PoolBlock* stack_pop(MemoryPool* pool) {
+  uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+  PoolBlock* top;
+  uint64_t next;
+  do {
+    top = stack_top(head);
+    if (!top) return NULL;
+    next = stack_head(__atomic_load_n(&top->next, __ATOMIC_RELAXED), head);
+  } while (!__atomic_compare_exchange_n(&pool->free_head, &head, next, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+  return top;
+}
 
-    if (pool->used_blocks > pool->peak_used)
-      pool->peak_used = pool->used_blocks;
+/* Blocks on a pool's free stack */
+static size_t stack_depth(MemoryPool* pool) {
+  PoolBlock* top =
+      stack_top(__atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE));
+  return top ? __atomic_load_n(&top->depth, __ATOMIC_RELAXED) + 1 : 0;
+}
 
-    heap_set_error(HEAP_SUCCESS, 0);
+/* Counters are updated outside the class lock, relaxed */
+#define POOL_COUNT(field, n) \
+  ((void)__atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED))
 
-    /* Return aligned payload */
-    return (void*)((char*)block + PAYLOAD_OFFSET);
+static void pool_note_used(MemoryPool* pool, size_t n) {
+  size_t used = __atomic_add_fetch(&pool->used_blocks, n, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&pool->peak_used, __ATOMIC_RELAXED);
+  while (used > peak &&
+         !__atomic_compare_exchange_n(&pool->peak_used, &peak, used, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
   }
+}
 
-  return NULL;
+/* Take a block from the slabs, mapping a new one if none is left (lock held) */
+static PoolBlock* pool_take(MemoryPool* pool) {
+  PoolSlab* s = pool->partial;
+  if (!s && !(s = slab_new(pool))) return NULL;
+
+  PoolBlock* block = s->free_list;
+  s->free_list = block->next;
+  if (s->used_blocks++ == 0) pool->empty_slabs--;
+  if (s->used_blocks > s->peak_used) s->peak_used = s->used_blocks;
+  if (!s->free_list) {
+    slab_unlink(&pool->partial, s);
+    slab_push(&pool->full, s);
+  }
+  return block;
 }
 
-/* Free pooled block */
-int pool_free(void* ptr) {
-  if (!ptr) {
-    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
-    return 0;
+/*
+ * Return a block to its slab (lock held). A slab that empties is kept while
+ * it is the pool's only empty one, so a pool hovering at a slab boundary does
+ * not map and unmap on every call; any further empty slab is retired.
+ */
+static void pool_give(MemoryPool* pool, PoolSlab* s, PoolBlock* block) {
+  if (!s->free_list) {
+    slab_unlink(&pool->full, s);
+    slab_push(&pool->partial, s);
   }
+  block->next = s->free_list;
+  s->free_list = block;
+
+  if (--s->used_blocks == 0) {
+    pool->empty_slabs++;
+    if (pool->empty_slabs > 1) slab_retire(pool, s);
+  }
+}
+
+/* Mark a block handed out to owner's thread and return its payload */
+static void* block_hand_out(MemoryPool* pool, PoolBlock* block,
+                            struct PoolOwner* owner) {
+  PoolSlab* s = slab_of_block(pool, block);
+  size_t idx = slab_block_index(pool, block);
+  __atomic_fetch_or(&s->used_map[idx / 64u], USED_BIT(idx), __ATOMIC_RELAXED);
+  /* a free-stack pop that lost its race may still read this word */
+  __atomic_store_n(&block->owner, owner, __ATOMIC_RELAXED);
+  return (void*)((char*)block + PAYLOAD_OFFSET);
+}
+
+/* Take a block from the free stack or, under the class lock, a slab */
+static PoolBlock* shared_take(PoolSet* set, int i) {
+  PoolBlock* block = stack_pop(&set->pools[i]);
+  if (block) return block;
+
+  heap_lock_acquire(&set->locks[i]);
+  block = pool_take(&set->pools[i]);
+  heap_lock_release(&set->locks[i]);
+  return block;
+}
+
+/* Put a freed block on the free stack or, if that is full, back in its slab */
+static void shared_give(PoolSet* set, int i, PoolBlock* block) {
+  MemoryPool* pool = &set->pools[i];
+  if (stack_push(pool, block)) return;
+
+  heap_lock_acquire(&set->locks[i]);
+  pool_give(pool, slab_of_block(pool, block), block);
+  heap_lock_release(&set->locks[i]);
+}
+
+#if HEAP_THREAD_SAFE
+/*
+ * Thread ownership (default set only, like the heap's thread cache): a block
+ * remembers the thread it was handed to. Freed by that thread, it goes on the
+ * thread's own list with no atomic operation; freed by any other, it is
+ * pushed on the owner's remote-free queue for its class, one CAS on a list
+ * only its owner takes from. The owner takes the whole queue with one
+ * exchange when its own list runs dry, so a producer thread gets back the
+ * blocks its consumers freed without either side taking a lock.
+ *
+ * Owner records are never unmapped: a remote free may still reach the record
+ * of a thread that just exited. A dead thread's record is reused by the next
+ * new thread, which inherits whatever arrived on its queues meanwhile. After
+ * fork() only the forking thread lives on; the child retires everyone else's
+ * record and hands their lists to the shared layer.
+ */
+struct PoolThread;
+
+typedef struct PoolOwner {
+  struct PoolOwner* next;        /* all records, newest first */
+  int live;                      /* held by a running thread */
+  struct PoolThread* thread;     /* its holder's lists, while live */
+  PoolBlock* remote[NUM_POOLS];  /* MPSC: blocks freed by other threads */
+} PoolOwner;
+
+typedef struct PoolThread {
+  PoolOwner* owner;              /* this thread's record, NULL until needed */
+  PoolBlock* local[NUM_POOLS];   /* blocks the thread can hand out again */
+  unsigned count[NUM_POOLS];     /* local blocks it freed itself */
+} PoolThread;
+
+static _Thread_local PoolThread _pool_thread;
+static PoolOwner* _owners;
+static HeapLock _owners_lock = HEAP_LOCK_INITIALIZER;
+static pthread_key_t _pool_thread_key;
+static pthread_once_t _pool_thread_once = PTHREAD_ONCE_INIT;
+
+/* Give every block of a list back to the shared layer */
+static void owner_list_flush(int i, PoolBlock* block) {
+  while (block) {
+    PoolBlock* next = block->next;
+    shared_give(&_pools, i, block);
+    block = next;
+  }
+}
+
+/* Thread exit: nothing may stay stranded on a dead thread's lists */
+static void pool_thread_exit(void* arg) {
+  PoolThread* pt = (PoolThread*)arg;
+  PoolOwner* o = pt->owner;
+  o->thread = NULL;
+  __atomic_store_n(&o->live, 0, __ATOMIC_RELEASE);
 
   for (int i = 0; i < NUM_POOLS; i++) {
-    MemoryPool* pool = &_pools[i];
+    owner_list_flush(i, pt->local[i]);
+    owner_list_flush(i, __atomic_exchange_n(&o->remote[i], NULL,
+                                            __ATOMIC_ACQUIRE));
+  }
+  memset(pt, 0, sizeof(*pt));
+}
 
-    if (!pool->pool_mem || pool->total_blocks == 0) continue;
+static void pool_thread_key_init(void) {
+  pthread_key_create(&_pool_thread_key, pool_thread_exit);
+}
 
-    char* start = (char*)pool->pool_mem;
-    char* end = start + pool->block_size * pool->total_blocks;
+/* Claim a dead thread's record, or map a page of new ones */
+static PoolOwner* owner_claim(void) {
+  for (PoolOwner* o = __atomic_load_n(&_owners, __ATOMIC_ACQUIRE); o;
+       o = o->next) {
+    int dead = 0;
+    if (__atomic_compare_exchange_n(&o->live, &dead, 1, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED))
+      return o;
+  }
 
-    /* Recover header from payload */
-    char* block_start = (char*)ptr - PAYLOAD_OFFSET;
+  long ps = sysconf(_SC_PAGESIZE);
+  size_t bytes = ALIGN_UP(sizeof(PoolOwner), ps > 0 ? (size_t)ps : 4096u);
+  PoolOwner* recs = (PoolOwner*)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (recs == MAP_FAILED) return NULL;
 
-    if (block_start < start || block_start >= end) continue;
+  /* fresh pages: every record starts dead with empty queues */
+  recs[0].live = 1;
+  heap_lock_acquire(&_owners_lock);
+  for (size_t k = bytes / sizeof(PoolOwner); k-- > 0;) {
+    recs[k].next = _owners;
+    __atomic_store_n(&_owners, &recs[k], __ATOMIC_RELEASE);
+  }
+  heap_lock_release(&_owners_lock);
+  return recs;
+}
 
-    size_t offset = (size_t)(block_start - start);
+/* This thread's record, registering its exit on first use */
+static PoolOwner* pool_thread_owner(void) {
+  PoolThread* pt = &_pool_thread;
+  if (pt->owner) return pt->owner;
 
-    /* Must land exactly on block boundary */
-    if (offset % pool->block_size != 0) {
-      heap_set_error(HEAP_INVALID_POINTER, EINVAL);
-      return 0;
-    }
+  pthread_once(&_pool_thread_once, pool_thread_key_init);
+  pt->owner = owner_claim();
+  if (pt->owner) {
+    pt->owner->thread = pt;
+    pthread_setspecific(_pool_thread_key, pt);
+  }
+  return pt->owner;
+}
 
-    PoolBlock* block = (PoolBlock*)block_start;
+/* A block from this thread's list, refilled from its remote queue if empty */
+static PoolBlock* owner_take(PoolThread* pt, int i) {
+  PoolBlock* block = pt->local[i];
+  if (!block) {
+    block = __atomic_exchange_n(&pt->owner->remote[i], NULL,
+                                __ATOMIC_ACQUIRE);
+    if (!block) return NULL;
+  } else if (pt->count[i]) {
+    pt->count[i]--;
+  }
+  pt->local[i] = block->next;
+  return block;
+}
+
+/* Free a block owned by o: 1 if it went to a thread list */
+static int owner_give(PoolOwner* o, int i, PoolBlock* block) {
+  PoolThread* pt = &_pool_thread;
+  if (o == pt->owner) {
+    if (pt->count[i] >= HEAP_POOL_CACHE_COUNT) return 0;
+    __atomic_store_n(&block->next, pt->local[i], __ATOMIC_RELAXED);
+    pt->local[i] = block;
+    pt->count[i]++;
+    return 1;
+  }
+
+  /* a dead owner's queue might not be drained for a long time */
+  if (!__atomic_load_n(&o->live, __ATOMIC_ACQUIRE)) return 0;
+  PoolBlock* head = __atomic_load_n(&o->remote[i], __ATOMIC_RELAXED);
+  do {
+    __atomic_store_n(&block->next, head, __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&o->remote[i], &head, block, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return 1;
+}
 
-    /* Double-free detection */
-    for (PoolBlock* cur = pool->free_list; cur; cur = cur->next) {
-      if (cur == block) {
-        heap_set_error(HEAP_DOUBLE_FREE, EINVAL);
-        return 0;
-      }
+void pool_fork_prepare(void) {
+  heap_lock_acquire(&_owners_lock);
+  pool_set_fork_prepare(&_pools);
+}
+
+void pool_fork_parent(void) {
+  pool_set_fork_parent(&_pools);
+  heap_lock_release(&_owners_lock);
+}
+
+/*
+ * The parent's other threads are gone: their records would stay live with
+ * nobody to drain their queues, so their blocks go back to the shared layer,
+ * the thread lists left in the copied thread-local storage included.
+ */
+void pool_fork_child(void) {
+  pool_set_fork_child(&_pools);
+  heap_lock_init(&_owners_lock);
+
+  PoolOwner* self = _pool_thread.owner;
+  for (PoolOwner* o = _owners; o; o = o->next) {
+    if (o == self || !o->live) continue;
+    struct PoolThread* pt = o->thread;
+    o->thread = NULL;
+    o->live = 0;
+    for (int i = 0; i < NUM_POOLS; i++) {
+      if (pt) owner_list_flush(i, pt->local[i]);
+      owner_list_flush(i, o->remote[i]);
+      o->remote[i] = NULL;
     }
+    if (pt) memset(pt, 0, sizeof(*pt));
+  }
+}
+#else
+void pool_fork_prepare(void) { pool_set_fork_prepare(&_pools); }
+void pool_fork_parent(void) { pool_set_fork_parent(&_pools); }
+void pool_fork_child(void) { pool_set_fork_child(&_pools); }
+#endif /* HEAP_THREAD_SAFE */
+
+/*
+ * Allocate from the smallest pool that fits; NULL leaves it to the heap. The
+ * thread's own blocks come first, then the free stack, both lock-free; the
+ * slabs, under the class lock, serve the rest.
+ */
+void* pool_set_alloc(PoolSet* set, size_t size) {
+  int i = pool_class_of(size);
+  if (i < 0) return NULL;
+
+  MemoryPool* pool = &set->pools[i];
+  if (!pool->block_size) return NULL;
+
+  POOL_COUNT(pool->alloc_requests, 1);
+
+  struct PoolOwner* owner = NULL;
+  PoolBlock* block = NULL;
+#if HEAP_THREAD_SAFE
+  if (set == &_pools && (owner = pool_thread_owner()))
+    block = owner_take(&_pool_thread, i);
+#endif
+  if (!block && !(block = shared_take(set, i))) {
+    POOL_COUNT(pool->alloc_failures, 1);
+    return NULL;
+  }
+  pool_note_used(pool, 1);
+  POOL_COUNT(pool->served_blocks, 1);
+  POOL_COUNT(pool->requested_bytes, size);
+
+  heap_set_error(HEAP_SUCCESS, 0);
+
+  /* Return aligned payload */
+  return block_hand_out(pool, block, owner);
+}
+
+void* pool_alloc(size_t size) { return pool_set_alloc(&_pools, size); }
+
+/* Take up to n blocks of one pool, the slab part under a single lock */
+size_t pool_alloc_batch(size_t size, size_t n, void** out) {
+  PoolSet* set = &_pools;
+  int i = pool_class_of(size);
+  if (i < 0) return 0;
+
+  MemoryPool* pool = &set->pools[i];
+  if (!pool->block_size) return 0;
+
+  POOL_COUNT(pool->alloc_requests, 1);
+
+  size_t got = 0;
+  for (PoolBlock* block; got < n && (block = stack_pop(pool));)
+    out[got++] = block_hand_out(pool, block, NULL);
+  if (got < n) {
+    size_t popped = got;
+    heap_lock_acquire(&set->locks[i]);
+    for (PoolBlock* block; got < n && (block = pool_take(pool));)
+      out[got++] = block;
+    heap_lock_release(&set->locks[i]);
+    for (size_t k = popped; k < got; k++)
+      out[k] = block_hand_out(pool, (PoolBlock*)out[k], NULL);
+    if (got < n) POOL_COUNT(pool->alloc_failures, 1);
+  }
+  pool_note_used(pool, got);
+  POOL_COUNT(pool->served_blocks, got);
+  POOL_COUNT(pool->requested_bytes, size * got);
+  return got;
+}
+
+/*
+ * Class of set holding ptr's block, -1 if ptr is not a pooled payload of
+ * set. Works from the pool's slab layout alone; the slab is not read.
+ */
+static int pool_index_of(PoolSet* set, const void* ptr) {
+  const char* block_start = (const char*)ptr - PAYLOAD_OFFSET;
+  MemoryPool* pool = slabmap_get(block_start);
+  if (!pool || pool < set->pools || pool >= set->pools + NUM_POOLS) return -1;
+
+  /* Must land exactly on block boundary */
+  const char* first =
+      (const char*)slab_of_block(pool, (const PoolBlock*)block_start) +
+      pool->slab_header_bytes;
+  if (block_start < first ||
+      block_start >= first + pool->slab_blocks * pool->block_size ||
+      (size_t)(block_start - first) % pool->block_size != 0)
+    return -1;
+  return (int)(pool - set->pools);
+}
+
+/* Usable payload bytes of a pooled block, 0 if ptr is not one */
+size_t pool_set_usable_size(PoolSet* set, const void* ptr) {
+  if (!ptr) return 0;
+  int i = pool_index_of(set, ptr);
+  return i < 0 ? 0 : set->pools[i].block_size - PAYLOAD_OFFSET;
+}
+
+size_t pool_usable_size(const void* ptr) {
+  return pool_set_usable_size(&_pools, ptr);
+}
+
+/* Allocation bit of pooled payload ptr of pool: set while it is handed out */
+static int pool_block_used(MemoryPool* pool, const void* ptr) {
+  const PoolBlock* block =
+      (const PoolBlock*)((const char*)ptr - PAYLOAD_OFFSET);
+  PoolSlab* s = slab_of_block(pool, block);
+  size_t idx = slab_block_index(pool, block);
+  return (__atomic_load_n(&s->used_map[idx / 64u], __ATOMIC_RELAXED) &
+          USED_BIT(idx)) != 0;
+}
+
+int pool_set_in_use(PoolSet* set, const void* ptr) {
+  if (!ptr) return 0;
+  int i = pool_index_of(set, ptr);
+  return i >= 0 && pool_block_used(&set->pools[i], ptr);
+}
+
+int pool_in_use(const void* ptr) { return pool_set_in_use(&_pools, ptr); }
+
+static void slab_list_unmark(PoolSlab* s, MemoryPool* pool) {
+  for (; s; s = s->next)
+    memset(s->used_map + pool->map_words, 0, pool->map_words * 8u);
+}
+
+void pool_set_gc_clear(PoolSet* set) {
+  for (int i = 0; i < NUM_POOLS; i++) {
+    MemoryPool* pool = &set->pools[i];
+    heap_lock_acquire(&set->locks[i]);
+    slab_list_unmark(pool->partial, pool);
+    slab_list_unmark(pool->full, pool);
+    heap_lock_release(&set->locks[i]);
+  }
+}
+
+/* The allocation bit tells a live block from one on a free list */
+size_t pool_set_gc_mark(PoolSet* set, const void* ptr) {
+  if (!ptr || ((uintptr_t)ptr & (sizeof(void*) - 1))) return 0;
+  int i = pool_index_of(set, ptr);
+  if (i < 0) return 0;
+
+  MemoryPool* pool = &set->pools[i];
+  if (!pool_block_used(pool, ptr)) return 0;
+
+  const PoolBlock* block =
+      (const PoolBlock*)((const char*)ptr - PAYLOAD_OFFSET);
+  PoolSlab* s = slab_of_block(pool, block);
+  size_t idx = slab_block_index(pool, block);
+  uint64_t* marks = s->used_map + pool->map_words;
+  if (marks[idx / 64u] & USED_BIT(idx)) return 0;
+  marks[idx / 64u] |= USED_BIT(idx);
+  return pool->block_size - PAYLOAD_OFFSET;
+}
+
+/*
+ * Free a pooled block of pool first or above: the slab map finds its class,
+ * clearing its bit in the slab's allocation bitmap catches double frees, and
+ * the block goes to its owning thread or on the free stack, all without a
+ * lock. Only when the stack is full does the block go back to its slab under
+ * the class lock.
+ */
+static int pool_free_from(PoolSet* set, void* ptr, int first) {
+  if (!ptr) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return 0;
+  }
+
+  int i = pool_index_of(set, ptr);
+  if (i < first) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return 0;
+  }
 
-    block->next = pool->free_list;
-    pool->free_list = block;
+  MemoryPool* pool = &set->pools[i];
+  /* Recover header from payload */
+  PoolBlock* block = (PoolBlock*)((char*)ptr - PAYLOAD_OFFSET);
+  PoolSlab* s = slab_of_block(pool, block);
+  struct PoolOwner* owner = block->owner;
 
-    pool->used_blocks--;
-    pool->free_blocks++;
-    pool->free_requests++;
+  /* Double-free detection: slabs are never unmapped under us (see retire) */
+  size_t idx = slab_block_index(pool, block);
+  uint64_t was = __atomic_fetch_and(&s->used_map[idx / 64u], ~USED_BIT(idx),
+                                    __ATOMIC_RELAXED);
+  if (!(was & USED_BIT(idx))) {
+    heap_set_error(HEAP_DOUBLE_FREE, EINVAL);
+    return 0;
+  }
 
+  __atomic_fetch_sub(&pool->used_blocks, 1, __ATOMIC_RELAXED);
+  POOL_COUNT(pool->free_requests, 1);
+#if HEAP_THREAD_SAFE
+  if (owner && owner_give(owner, i, block)) {
     heap_set_error(HEAP_SUCCESS, 0);
     return 1;
   }
+#else
+  (void)owner;
+#endif
+  shared_give(set, i, block);
 
-  heap_set_error(HEAP_INVALID_POINTER, EINVAL);
-  return 0;
+  heap_set_error(HEAP_SUCCESS, 0);
+  return 1;
+}
+
+/* Free pooled block */
+int pool_set_free(PoolSet* set, void* ptr) {
+  return pool_free_from(set, ptr, 0);
 }
 
+int pool_free(void* ptr) { return pool_free_from(&_pools, ptr, 0); }
+
+/* Free a pooled block of size bytes: pools too small for it are skipped */
+int pool_free_sized(void* ptr, size_t size) {
+  int first = pool_class_of(size);
+  if (first < 0) return 0;
+  return pool_free_from(&_pools, ptr, first);
+}
+
+
+/* fork(): hold every pool lock across it, then release or re-create them */
+void pool_set_fork_prepare(PoolSet* set) {
+  for (int i = 0; i < NUM_POOLS; i++) heap_lock_acquire(&set->locks[i]);
+}
+
+void pool_set_fork_parent(PoolSet* set) {
+  for (int i = NUM_POOLS; i-- > 0;) heap_lock_release(&set->locks[i]);
+}
+
+void pool_set_fork_child(PoolSet* set) {
+  for (int i = 0; i < NUM_POOLS; i++) heap_lock_init(&set->locks[i]);
+}
+
+static const char* pages_name(unsigned pages) {
+  return pages == SEGMENT_PAGES_HUGETLB ? "hugetlb"
+         : pages == SEGMENT_PAGES_THP   ? "thp"
+                                        : "base";
+}
+
+static void slab_print_stats(PoolSlab* s) {
+  size_t free_count = 0;
+  for (PoolBlock* cur = s->free_list; cur; cur = cur->next) free_count++;
+
+  printf("    slab %p: used=%zu/%zu peak=%zu pages=%s\n", (void*)s,
+         s->used_blocks, s->total_blocks, s->peak_used, pages_name(s->pages));
+  if (free_count != s->total_blocks - s->used_blocks) {
+    printf("    WARNING: Free count mismatch! list=%zu stats=%zu\n",
+           free_count, s->total_blocks - s->used_blocks);
+  }
+}
 
 /* Print pool statistics */
+#define POOL_READ(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+HeapErrorCode pool_set_get_stats(PoolSet* set, PoolStats* out) {
+  if (!set || !out) {
+    heap_set_error(HEAP_INVALID_POINTER, EINVAL);
+    return HEAP_INVALID_POINTER;
+  }
+
+  memset(out, 0, sizeof(*out));
+  size_t payload_bytes = 0;
+  size_t requested_bytes = 0;
+
+  for (int i = 0; i < NUM_POOLS; i++) {
+    MemoryPool* pool = &set->pools[i];
+    PoolClassStats* c = &out->classes[i];
+    c->block_size = pool->block_size;
+    if (!pool->block_size) continue;
+
+    /* slab counts only change on the slow path, under the class lock */
+    heap_lock_acquire(&set->locks[i]);
+    c->slabs = pool->slabs;
+    c->total_blocks = pool->total_blocks;
+    heap_lock_release(&set->locks[i]);
+
+    c->used_blocks = POOL_READ(pool->used_blocks);
+    c->peak_used = POOL_READ(pool->peak_used);
+    c->alloc_requests = POOL_READ(pool->alloc_requests);
+    c->served_blocks = POOL_READ(pool->served_blocks);
+    c->requested_bytes = POOL_READ(pool->requested_bytes);
+    c->free_requests = POOL_READ(pool->free_requests);
+    c->alloc_failures = POOL_READ(pool->alloc_failures);
+
+    size_t free_blocks =
+        c->total_blocks > c->used_blocks ? c->total_blocks - c->used_blocks : 0;
+    out->mapped_bytes += c->slabs * pool->slab_bytes;
+    out->used_bytes += c->used_blocks * pool->block_size;
+    out->free_bytes += free_blocks * pool->block_size;
+    out->free_blocks += free_blocks;
+    payload_bytes += c->served_blocks * (pool->block_size - PAYLOAD_OFFSET);
+    requested_bytes += c->requested_bytes;
+  }
+
+  if (payload_bytes > requested_bytes)
+    out->fragmentation =
+        (double)(payload_bytes - requested_bytes) / (double)payload_bytes;
+
+  heap_set_error(HEAP_SUCCESS, 0);
+  return HEAP_SUCCESS;
+}
+
+HeapErrorCode pool_get_stats(PoolStats* out) {
+  return pool_set_get_stats(&_pools, out);
+}
+
 void pool_print_stats(void) {
+  PoolSet* set = &_pools;
   printf("\n=== Memory Pool Statistics ===\n");
   printf("Total pools: %d\n", NUM_POOLS);
-  printf("Blocks per pool: %d\n", POOL_BLOCKS_PER_SIZE);
+  printf("Slab size: %u bytes\n", POOL_SLAB_BYTES);
   printf("\n");
 
   size_t total_alloc_requests = 0;
@@ -184,50 +951,78 @@ void pool_print_stats(void) {
   size_t total_used_blocks = 0;
   size_t total_free_blocks = 0;
   size_t total_capacity = 0;
+  size_t total_payload_bytes = 0;
+  size_t total_requested_bytes = 0;
 
   for (int i = 0; i < NUM_POOLS; i++) {
-    MemoryPool* pool = &_pools[i];
+    MemoryPool* pool = &set->pools[i];
 
-    printf("Pool %d [%zu bytes per block]:\n", i, pool->block_size);
+    printf("Pool %d [%zu bytes per block]:", i, pool->block_size);
 
-    if (!pool->pool_mem) {
-      printf("  Status: FAILED TO INITIALIZE\n");
+    if (!pool->block_size) {
+      printf("\n  Status: FAILED TO INITIALIZE\n");
       continue;
     }
 
+    heap_lock_acquire(&set->locks[i]);
+    /* most classes of a fine-grained set are never touched */
+    if (!pool->slabs && !pool->alloc_requests) {
+      heap_lock_release(&set->locks[i]);
+      printf(" unused\n");
+      continue;
+    }
+    printf("\n");
     printf("  Status: ACTIVE\n");
-    printf("  Memory region: %p - %p\n", pool->pool_mem,
-           (char*)pool->pool_mem + pool->block_size * pool->total_blocks);
+    printf("  Slabs: %zu (%zu empty, %zu bytes each)\n", pool->slabs,
+           pool->empty_slabs, pool->slab_bytes);
     printf("  Total blocks: %zu\n", pool->total_blocks);
-    printf("  Used blocks: %zu\n", pool->used_blocks);
-    printf("  Free blocks: %zu\n", pool->free_blocks);
+    size_t used = __atomic_load_n(&pool->used_blocks, __ATOMIC_RELAXED);
+    size_t free_blocks = pool->total_blocks - used;
+    printf("  Used blocks: %zu\n", used);
+    printf("  Free blocks: %zu (%zu on the free stack)\n", free_blocks,
+           stack_depth(pool));
     printf("  Peak used: %zu\n", pool->peak_used);
     printf("  Allocation requests: %zu\n", pool->alloc_requests);
     printf("  Free requests: %zu\n", pool->free_requests);
     printf("  Allocation failures: %zu\n", pool->alloc_failures);
-    printf("  Free list head: %p\n", (void*)pool->free_list);
-
-    size_t free_count = 0;
-    for (PoolBlock* cur = pool->free_list; cur; cur = cur->next) free_count++;
 
-    if (free_count != pool->free_blocks) {
-      printf("  WARNING: Free count mismatch! list=%zu stats=%zu\n", free_count,
-             pool->free_blocks);
+    size_t slab_blocks_total = 0;
+    for (PoolSlab* s = pool->partial; s; s = s->next) {
+      slab_print_stats(s);
+      slab_blocks_total += s->total_blocks;
+    }
+    for (PoolSlab* s = pool->full; s; s = s->next) {
+      slab_print_stats(s);
+      slab_blocks_total += s->total_blocks;
     }
 
-    if (pool->used_blocks + pool->free_blocks != pool->total_blocks) {
+    if (slab_blocks_total != pool->total_blocks || used > pool->total_blocks) {
       printf("  WARNING: Block count inconsistent!\n");
     }
 
-    printf("  Utilization: %.1f%%\n",
-           100.0 * pool->used_blocks / pool->total_blocks);
+    if (pool->total_blocks)
+      printf("  Utilization: %.1f%%\n",
+             100.0 * used / pool->total_blocks);
+
+    /* Internal fragmentation: payload handed out but never asked for */
+    size_t payload = pool->block_size - PAYLOAD_OFFSET;
+    if (pool->served_blocks) {
+      size_t payload_bytes = pool->served_blocks * payload;
+      printf("  Internal fragmentation: %.1f%% (avg request %.1f of %zu "
+             "bytes)\n",
+             100.0 * (payload_bytes - pool->requested_bytes) / payload_bytes,
+             (double)pool->requested_bytes / pool->served_blocks, payload);
+      total_payload_bytes += payload_bytes;
+      total_requested_bytes += pool->requested_bytes;
+    }
 
     total_alloc_requests += pool->alloc_requests;
     total_free_requests += pool->free_requests;
     total_alloc_failures += pool->alloc_failures;
-    total_used_blocks += pool->used_blocks;
-    total_free_blocks += pool->free_blocks;
+    total_used_blocks += used;
+    total_free_blocks += free_blocks;
     total_capacity += pool->total_blocks;
+    heap_lock_release(&set->locks[i]);
 
     printf("\n");
   }
@@ -239,9 +1034,16 @@ void pool_print_stats(void) {
   printf("Total allocation requests: %zu\n", total_alloc_requests);
   printf("Total free requests: %zu\n", total_free_requests);
   printf("Total allocation failures: %zu\n", total_alloc_failures);
-  printf("Overall utilization: %.1f%%\n",
-         100.0 * total_used_blocks / total_capacity);
-  printf("Failure rate: %.1f%%\n",
-         100.0 * total_alloc_failures / total_alloc_requests);
+  if (total_capacity)
+    printf("Overall utilization: %.1f%%\n",
+           100.0 * total_used_blocks / total_capacity);
+  if (total_payload_bytes)
+    printf("Internal fragmentation: %.1f%% of %zu payload bytes served\n",
+           100.0 * (total_payload_bytes - total_requested_bytes) /
+               total_payload_bytes,
+           total_payload_bytes);
+  if (total_alloc_requests)
+    printf("Failure rate: %.1f%%\n",
+           100.0 * total_alloc_failures / total_alloc_requests);
   printf("===============================\n");
 }
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "heap_config.h"
+#include "heap_errors.h"
+#include "heap_segment.h"
+
+/*
+ * Two-level radix map from address granule (ptr >> HEAP_SEGMENT_SHIFT) to
+ * the segment covering it. Segments are aligned to a granule, so a lookup is
+ * two loads and a range check, independent of how many segments exist.
+ */
+#define SEGMAP_BITS (HEAP_ADDR_BITS - HEAP_SEGMENT_SHIFT)
+#define SEGMAP_ROOT_BITS (SEGMAP_BITS / 2u)
+#define SEGMAP_LEAF_BITS (SEGMAP_BITS - SEGMAP_ROOT_BITS)
+#define SEGMAP_LEAF_SIZE ((size_t)1 << SEGMAP_LEAF_BITS)
+#define SEGMENT_ALIGN ((size_t)1 << HEAP_SEGMENT_SHIFT)
+
+static Segment** _segmap[(size_t)1 << SEGMAP_ROOT_BITS];
+
+/*
+ * Writers (segment create/resize/destroy) run concurrently: under different
+ * arena locks, in the lock-free direct path and from separate heaps. Each
+ * granule belongs to one segment, so only leaf installation can race; it is
+ * settled with a CAS. Lookups are lock-free, so entries are published with
+ * release/acquire ordering.
+ */
+
+/* Leaf slot for a granule key, allocating the leaf if asked to */
+static Segment** segmap_slot(uintptr_t key, int create) {
+  Segment*** root = &_segmap[key >> SEGMAP_LEAF_BITS];
+  Segment** leaf = __atomic_load_n(root, __ATOMIC_ACQUIRE);
+
+  if (!leaf) {
+    if (!create) return NULL;
+    size_t bytes = SEGMAP_LEAF_SIZE * sizeof(Segment*);
+    void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return NULL;
+    /* another creator may install the leaf first; keep theirs */
+    if (!__atomic_compare_exchange_n(root, &leaf, (Segment**)mem, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      munmap(mem, bytes);
+    else
+      leaf = (Segment**)mem;
+  }
+
+  return &leaf[key & (SEGMAP_LEAF_SIZE - 1)];
+}
+
+/* Point every granule of [start, start + bytes) at seg */
+static int segmap_set(char* start, size_t bytes, Segment* seg) {
+  uintptr_t first = (uintptr_t)start >> HEAP_SEGMENT_SHIFT;
+  uintptr_t last = ((uintptr_t)start + bytes - 1) >> HEAP_SEGMENT_SHIFT;
+
+  if (last >> SEGMAP_BITS) return 0;
+
+  for (uintptr_t key = first; key <= last; key++) {
+    Segment** slot = segmap_slot(key, seg != NULL);
+    if (slot)
+      __atomic_store_n(slot, seg, __ATOMIC_RELEASE);
+    else if (seg)
+      return 0;
+  }
+  return 1;
+}
+
+/* mmap `bytes` starting on an `align` boundary */
+static void* map_aligned(size_t bytes, size_t align) {
+  if (bytes > SIZE_MAX - align) return NULL;
+
+  size_t span = bytes + align;
+  char* raw = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) return NULL;
+
+  char* start =
+      (char*)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+  char* stop = start + bytes;
+
+  if (start > raw) munmap(raw, (size_t)(start - raw));
+  if (raw + span > stop) munmap(stop, (size_t)(raw + span - stop));
+  return start;
+}
+
+void* segment_map(size_t bytes, size_t align, int huge, unsigned* pages) {
+  *pages = SEGMENT_PAGES_BASE;
+  if (!huge) return map_aligned(bytes, align);
+
+  /* reserved huge pages come aligned to their own size */
+  void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mem != MAP_FAILED) {
+    if (((uintptr_t)mem & (align - 1)) == 0) {
+      *pages = SEGMENT_PAGES_HUGETLB;
+      return mem;
+    }
+    munmap(mem, bytes);
+  }
+
+  if (align < HEAP_HUGE_PAGE_BYTES) align = HEAP_HUGE_PAGE_BYTES;
+  mem = map_aligned(bytes, align);
+  if (mem && madvise(mem, bytes, MADV_HUGEPAGE) == 0)
+    *pages = SEGMENT_PAGES_THP;
+  return mem;
+}
+
+/* Create a segment in [mem, mem + bytes) and register it */
+static Segment* segment_init(char* mem, size_t bytes, unsigned pages) {
+  if (!mem) {
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
+  }
+
+  Segment* seg = (Segment*)mem;
+  seg->next = NULL;
+  seg->prev = NULL;
+  seg->arena = NULL;
+  seg->size = bytes;
+  seg->pages = pages;
+  seg->blocks = (Header*)(mem + SEGMENT_HEADER_BYTES);
+  seg->end = (Header*)(mem + bytes - HEADER_SIZE_BYTES);
+
+  if (!segmap_set(mem, bytes, seg)) {
+    segmap_set(mem, bytes, NULL);
+    munmap(mem, bytes);
+    heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+    return NULL;
+  }
+
+  return seg;
+}
+
+Segment* segment_create(size_t bytes, int huge) {
+  if (bytes < SEGMENT_HEADER_BYTES + 2 * HEADER_SIZE_BYTES) {
+    heap_set_error(HEAP_INVALID_SIZE, EINVAL);
+    return NULL;
+  }
+
+  unsigned pages;
+  char* mem = segment_map(bytes, SEGMENT_ALIGN, huge, &pages);
+  return segment_init(mem, bytes, pages);
+}
+
+Segment* segment_create_aligned(size_t bytes, size_t align) {
+  if (bytes < SEGMENT_HEADER_BYTES + 2 * HEADER_SIZE_BYTES) {
+    heap_set_error(HEAP_INVALID_SIZE, EINVAL);
+    return NULL;
+  }
+  if (align < SEGMENT_ALIGN) align = SEGMENT_ALIGN;
+
+  return segment_init(map_aligned(bytes, align), bytes, SEGMENT_PAGES_BASE);
+}
+
+void segment_destroy(Segment* seg) {
+  if (!seg) return;
+  segmap_set((char*)seg, seg->size, NULL);
+  munmap(seg, seg->size);
+}
+
+Segment* segment_resize(Segment* seg, size_t bytes) {
+  if (bytes < SEGMENT_HEADER_BYTES + 2 * HEADER_SIZE_BYTES) {
+    heap_set_error(HEAP_INVALID_SIZE, EINVAL);
+    return NULL;
+  }
+
+  char* old = (char*)seg;
+  size_t old_bytes = seg->size;
+  size_t lead = (size_t)((char*)seg->blocks - old);
+
+  if (bytes <= old_bytes) {
+    /* drop the granules past the new end, keeping the one it falls in */
+    size_t keep = (bytes + SEGMENT_ALIGN - 1) & ~(SEGMENT_ALIGN - 1);
+    if (keep < old_bytes) segmap_set(old + keep, old_bytes - keep, NULL);
+    if (bytes < old_bytes) munmap(old + bytes, old_bytes - bytes);
+  } else if (mremap(old, old_bytes, bytes, 0) != MAP_FAILED) {
+    /* grown in place: the address space behind the segment was free */
+    if (!segmap_set(old, bytes, seg)) {
+      mremap(old, bytes, old_bytes, 0);
+      heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+      return NULL;
+    }
+  } else {
+    /* move the pages to a fresh aligned range; nothing is copied */
+    char* mem = map_aligned(bytes, SEGMENT_ALIGN);
+    if (!mem) {
+      heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+      return NULL;
+    }
+    if (!segmap_set(mem, bytes, (Segment*)mem) ||
+        mremap(old, old_bytes, bytes, MREMAP_MAYMOVE | MREMAP_FIXED, mem) ==
+            MAP_FAILED) {
+      segmap_set(mem, bytes, NULL);
+      munmap(mem, bytes);
+      heap_set_error(HEAP_OUT_OF_MEMORY, ENOMEM);
+      return NULL;
+    }
+    segmap_set(old, old_bytes, NULL);
+    old = mem;
+  }
+
+  seg = (Segment*)old;
+  seg->size = bytes;
+  seg->blocks = (Header*)(old + lead);
+  seg->end = (Header*)(old + bytes - HEADER_SIZE_BYTES);
+  return seg;
+}
+
+size_t segment_decommit(void* addr, size_t bytes) {
+  /* MADV_DONTNEED, not MADV_FREE: the pages must read back as zero */
+  if (madvise(addr, bytes, MADV_DONTNEED) != 0) return 0;
+  return bytes;
+}
+
+Segment* heap_segment_of(const void* ptr) {
+  uintptr_t key = (uintptr_t)ptr >> HEAP_SEGMENT_SHIFT;
+  if (key >> SEGMAP_BITS) return NULL;
+
+  Segment** leaf =
+      __atomic_load_n(&_segmap[key >> SEGMAP_LEAF_BITS], __ATOMIC_ACQUIRE);
+  if (!leaf) return NULL;
+
+  Segment* seg =
+      __atomic_load_n(&leaf[key & (SEGMAP_LEAF_SIZE - 1)], __ATOMIC_ACQUIRE);
+  if (!seg || (const char*)ptr >= (const char*)seg + seg->size) return NULL;
+  return seg;
+}
@@ -1,6 +1,7 @@
 #define _POSIX_C_SOURCE 199309L
 
 #include "heap_spray.h"
+#include "heap_config.h"
 
 #include <string.h>
 #include <time.h>
@@ -14,8 +15,9 @@ typedef struct {
   unsigned long long whenHappened;
 } allocation_size_time;
 
-static allocation_size_time events[MAX_EVENTS];
-static int event_count;
+/* History is per thread: each thread's pattern is judged on its own */
+static _Thread_local allocation_size_time events[MAX_EVENTS];
+static _Thread_local int event_count;
 
 /* Get current monotonic time in nanoseconds */
 static long long getCurrentTime(void) {
@@ -32,6 +34,8 @@ void heap_spray_init(void) {
 
 /* Check allocation pattern for heap spray */
 int heap_spray_check(size_t size) {
+  if (!HEAP_SPRAY_CHECK) return HEAP_SPRAY_OK;
+
   long long t = getCurrentTime();
 
   /* Shift old events left */
@@ -0,0 +1,96 @@
+#ifndef TEST_ALIGNED_H
+#define TEST_ALIGNED_H
+
+#include <stdint.h>
+
+#include "heap.h"
+#include "heap_garbage.h"
+#include "test_utils.h"
+
+static void test_aligned_alloc(void) {
+  LOG_TEST("Testing aligned allocation...");
+
+  HeapErrorCode res = hinit(64 * 1024);
+  assert(res == HEAP_SUCCESS);
+
+  /* cache line, page and larger alignments from the arenas */
+  static const size_t aligns[] = {32, 64, 256, 4096, 65536};
+  void* ptrs[5];
+  for (int i = 0; i < 5; i++) {
+    size_t size = 100 + (size_t)i * 40;
+    ptrs[i] = haligned_alloc(aligns[i], size);
+    ASSERT_HEAP_SUCCESS(ptrs[i]);
+    assert(((uintptr_t)ptrs[i] & (aligns[i] - 1)) == 0);
+    memset(ptrs[i], 0x3C, size);
+  }
+  printf("[PASS] Payloads aligned to 32..65536 bytes\n");
+
+  /* the padding in front is split off, not charged to the block */
+  size_t before = test_bytes_in_use();
+  void* page = haligned_alloc(4096, 200);
+  ASSERT_HEAP_SUCCESS(page);
+  assert(((uintptr_t)page & 4095) == 0);
+  assert(test_bytes_in_use() - before < 512);
+  printf("[PASS] Page-aligned 200 bytes cost %zu block bytes\n",
+         test_bytes_in_use() - before);
+
+  for (int i = 0; i < 5; i++) {
+    hfree(ptrs[i]);
+    ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  }
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  hfree(ptrs[0]);
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+#endif
+
+  /* large requests get an aligned mapping of their own */
+  unsigned char* huge = (unsigned char*)haligned_alloc(2u << 20, 300 * 1024);
+  ASSERT_HEAP_SUCCESS(huge);
+  assert(((uintptr_t)huge & ((2u << 20) - 1)) == 0);
+  memset(huge, 0x42, 300 * 1024);
+  unsigned char* grown = (unsigned char*)hrealloc(huge, 600 * 1024);
+  ASSERT_HEAP_SUCCESS(grown);
+  assert(grown[0] == 0x42 && grown[300 * 1024 - 1] == 0x42);
+  hfree(grown);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  printf("[PASS] 2 MB aligned direct mapping\n");
+
+  /* argument checks */
+  assert(haligned_alloc(24, 64) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_ALIGNMENT_ERROR);
+  void* small = haligned_alloc(8, 40);
+  ASSERT_HEAP_SUCCESS(small);
+
+  void* pm = NULL;
+  assert(hposix_memalign(&pm, 128, 500) == 0);
+  assert(pm && ((uintptr_t)pm & 127) == 0);
+  assert(hposix_memalign(&pm, 4, 500) == EINVAL);
+  printf("[PASS] hposix_memalign\n");
+
+  /* the GC follows pointers to aligned payloads */
+  void* keep = haligned_alloc(512, 300);
+  void* drop = haligned_alloc(512, 340);
+  ASSERT_HEAP_SUCCESS(keep);
+  ASSERT_HEAP_SUCCESS(drop);
+  gc_add_root(&keep);
+  gc_add_root(&pm);
+  gc_add_root(&small);
+  gc_add_root(&page);
+  gc_collect();
+  hfree(keep);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  printf("[PASS] GC keeps rooted aligned blocks\n");
+
+  gc_remove_root(&keep);
+  gc_remove_root(&pm);
+  gc_remove_root(&small);
+  gc_remove_root(&page);
+  hfree(pm);
+  hfree(small);
+  hfree(page);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_ALIGNED_H */
@@ -0,0 +1,118 @@
+#ifndef TEST_ARENAS_H
+#define TEST_ARENAS_H
+
+#include <pthread.h>
+
+#include "heap.h"
+#include "test_utils.h"
+
+#define ARENAS_COUNT 4
+#define ARENAS_BLOCKS 64
+#define ARENAS_BLOCK_SIZE 4000  /* past the pools and thread caches */
+#define ARENAS_PEAK_BLOCKS 256
+#define ARENAS_PEAK_SIZE 40000  /* below the direct-mapping threshold */
+
+/* Allocate blocks and hand them back to the main thread to free */
+static void* arenas_worker(void* arg) {
+  void** blocks = (void**)arg;
+  for (int i = 0; i < ARENAS_BLOCKS; i++) {
+    /* vary the size so the spray detector stays quiet */
+    size_t size = ARENAS_BLOCK_SIZE + (size_t)i * 32;
+    blocks[i] = halloc(size);
+    if (blocks[i]) memset(blocks[i], 0xA5, size);
+  }
+  return NULL;
+}
+
+/* Hold at least *arg bytes at once, then give them all back */
+static void* arenas_peak_worker(void* arg) {
+  size_t target = *(size_t*)arg, held = 0;
+  void* blocks[ARENAS_PEAK_BLOCKS];
+  int n = 0;
+  while (held < target) {
+    assert(n < ARENAS_PEAK_BLOCKS);
+    size_t size = ARENAS_PEAK_SIZE + (size_t)n * 64;
+    blocks[n] = halloc(size);
+    assert(blocks[n]);
+    held += size;
+    n++;
+  }
+  while (n > 0) hfree(blocks[--n]);
+  return NULL;
+}
+
+static void test_arenas(void) {
+  LOG_TEST("Testing arenas...");
+
+  HeapConfig cfg = {.initial_bytes = 64 * 1024, .arenas = ARENAS_COUNT};
+  HeapErrorCode res = hinit_config(&cfg);
+  assert(res == HEAP_SUCCESS);
+  assert(heap_arena_count() == ARENAS_COUNT);
+  printf("[PASS] %u arenas configured\n", heap_arena_count());
+
+  /* the main thread takes arena 0, the workers are dealt out after it */
+  void* own = halloc(ARENAS_BLOCK_SIZE);
+  ASSERT_HEAP_SUCCESS(own);
+
+  pthread_t threads[ARENAS_COUNT];
+  void* blocks[ARENAS_COUNT][ARENAS_BLOCKS];
+  for (int t = 0; t < ARENAS_COUNT; t++)
+    pthread_create(&threads[t], NULL, arenas_worker, blocks[t]);
+  for (int t = 0; t < ARENAS_COUNT; t++) pthread_join(threads[t], NULL);
+
+  HeapArenaStats st;
+  size_t threads_assigned = 0;
+  for (unsigned a = 0; a < ARENAS_COUNT; a++) {
+    assert(heap_arena_stats(a, &st) == HEAP_SUCCESS);
+    assert(st.allocs > 0);
+    assert(st.mapped_bytes > 0);
+    threads_assigned += st.threads;
+  }
+  assert(threads_assigned == 1);
+  printf("[PASS] Every arena served allocations; exited threads released\n");
+
+  assert(heap_arena_stats(ARENAS_COUNT, &st) == HEAP_INVALID_POINTER);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+
+  /* cross-thread frees go back to the arena that carved the block */
+  for (int t = 0; t < ARENAS_COUNT; t++)
+    for (int i = 0; i < ARENAS_BLOCKS; i++) {
+      assert(blocks[t][i] != NULL);
+      hfree(blocks[t][i]);
+      assert(heap_last_error() == HEAP_SUCCESS);
+    }
+  hfree(own);
+
+  for (unsigned a = 0; a < ARENAS_COUNT; a++) {
+    assert(heap_arena_stats(a, &st) == HEAP_SUCCESS);
+    assert(st.bytes_in_use == 0);
+    assert(st.allocs == st.frees);
+  }
+
+  size_t live = 0;
+  for (Header* bp = heap_first_block(); bp; bp = heap_next_block(bp))
+    if (IS_INUSE(bp)) live++;
+  assert(live == 0);
+  printf("[PASS] Remote frees returned to owning arenas\n");
+
+  /* two threads peak one after the other on different arenas: the heap's
+     peak is one of them, not their sum */
+  HeapStats hs;
+  assert(heap_get_stats(&hs) == HEAP_SUCCESS);
+  size_t target = hs.peak_in_use + hs.peak_in_use / 2;
+  for (int t = 0; t < 2; t++) {
+    pthread_create(&threads[t], NULL, arenas_peak_worker, &target);
+    pthread_join(threads[t], NULL);
+  }
+  assert(heap_get_stats(&hs) == HEAP_SUCCESS);
+  assert(hs.bytes_in_use == 0);
+  assert(hs.peak_in_use >= target && hs.peak_in_use < target + target / 2);
+  printf("[PASS] Peak %zu bytes over arenas that peaked apart\n",
+         hs.peak_in_use);
+
+  heap_arena_print_stats();
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_ARENAS_H */
@@ -0,0 +1,81 @@
+#ifndef TEST_BATCH_H
+#define TEST_BATCH_H
+
+#include "heap.h"
+#include "heap_config.h"
+#include "test_utils.h"
+
+#define BATCH_N 16
+#define BATCH_SIZE 2500 /* past the pools and the thread cache */
+
+static void test_batch(void) {
+  LOG_TEST("Testing batch allocation and free...");
+
+  HeapErrorCode res = hinit(1024 * 1024);
+  assert(res == HEAP_SUCCESS);
+  size_t base = test_bytes_in_use();
+
+  /* one span, carved front to back, every block zeroed */
+  void* out[BATCH_N];
+  assert(halloc_batch(BATCH_SIZE, BATCH_N, out) == BATCH_N);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  size_t stride = (size_t)((char*)out[1] - (char*)out[0]);
+  assert(stride >= BATCH_SIZE);
+  for (int i = 0; i < BATCH_N; i++) {
+    if (i) assert((char*)out[i] - (char*)out[i - 1] == (ptrdiff_t)stride);
+    for (size_t j = 0; j < BATCH_SIZE; j++)
+      assert(((unsigned char*)out[i])[j] == 0);
+    memset(out[i], 0xAB, BATCH_SIZE);
+  }
+  printf("[PASS] Batch carved from one span\n");
+
+  /* freed in any order, the set merges back into one block */
+  void* first = out[0];
+  for (int i = 0; i < BATCH_N / 2; i++) {
+    void* t = out[i];
+    out[i] = out[BATCH_N - 1 - i];
+    out[BATCH_N - 1 - i] = t;
+  }
+  hfree_batch(out, BATCH_N);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(out[0] == first);
+  assert(test_bytes_in_use() == base);
+  void* whole = halloc(BATCH_N * stride - 64);
+  ASSERT_HEAP_SUCCESS(whole);
+  assert(whole == first);
+  hfree(whole);
+  printf("[PASS] Batch free coalesces the set\n");
+
+  /* small sizes come from the pools as well */
+  void* small[BATCH_N];
+  assert(halloc_batch(24, BATCH_N, small) == BATCH_N);
+  for (int i = 0; i < BATCH_N; i++) {
+    for (int j = 0; j < 24; j++) assert(((unsigned char*)small[i])[j] == 0);
+    for (int k = 0; k < i; k++) assert(small[k] != small[i]);
+  }
+  hfree_batch(small, BATCH_N);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  printf("[PASS] Small batches\n");
+
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  /* a pointer listed twice is freed once and reported */
+  void* dup[4];
+  assert(halloc_batch(BATCH_SIZE, 3, dup) == 3);
+  dup[3] = dup[1];
+  hfree_batch(dup, 4);
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+  assert(test_bytes_in_use() == base);
+  printf("[PASS] Double free inside a batch\n");
+#endif
+
+  /* more than the heap can map: nothing stays allocated */
+  static void* many[12000];
+  assert(halloc_batch(100000, 12000, many) == 0);
+  ASSERT_HEAP_ERROR(HEAP_OUT_OF_MEMORY);
+  assert(test_bytes_in_use() == base);
+  printf("[PASS] Failed batch allocates nothing\n");
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_BATCH_H */
@@ -0,0 +1,62 @@
+#ifndef TEST_BESTFIT_H
+#define TEST_BESTFIT_H
+
+#include "heap.h"
+#include "test_utils.h"
+
+static void test_best_fit(void) {
+  LOG_TEST("Testing best-fit placement of large blocks...");
+
+  HeapErrorCode res = hinit(256 * 1024);
+  assert(res == HEAP_SUCCESS);
+
+  /* holes of 20K, 8K, 12K and 8K, kept apart by live separators (too big
+     for the thread cache, so they are carved in order) */
+  static const size_t holes[] = {20000, 8000, 12000, 8000};
+  void* hole[4];
+  void* sep[4];
+  for (int i = 0; i < 4; i++) {
+    hole[i] = halloc(holes[i]);
+    sep[i] = halloc(2100 + (size_t)i * 40);
+    ASSERT_HEAP_SUCCESS(hole[i]);
+    ASSERT_HEAP_SUCCESS(sep[i]);
+  }
+  for (int i = 0; i < 4; i++) hfree(hole[i]);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  /* the smallest hole that fits wins, the lower address on a tie */
+  void* a = halloc(7900);
+  ASSERT_HEAP_SUCCESS(a);
+  assert(a == hole[1]);
+  void* b = halloc(7800);
+  ASSERT_HEAP_SUCCESS(b);
+  assert(b == hole[3]);
+  void* c = halloc(11000);
+  ASSERT_HEAP_SUCCESS(c);
+  assert(c == hole[2]);
+  printf("[PASS] Best fit with address tie-break\n");
+
+  /* merging re-files the block under its new size */
+  hfree(b);
+  hfree(sep[2]);
+  hfree(c);
+  void* merged = halloc(20100);
+  ASSERT_HEAP_SUCCESS(merged);
+  assert(merged == c);
+  void* big = halloc(19000);
+  ASSERT_HEAP_SUCCESS(big);
+  assert(big == hole[0]);
+  printf("[PASS] Coalesced blocks are found by their merged size\n");
+
+  hfree(a);
+  hfree(merged);
+  hfree(big);
+  hfree(sep[0]);
+  hfree(sep[1]);
+  hfree(sep[3]);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_BESTFIT_H */
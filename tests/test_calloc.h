@@ -0,0 +1,81 @@
+#ifndef TEST_CALLOC_H
+#define TEST_CALLOC_H
+
+#include <stdint.h>
+
+#include "heap.h"
+#include "test_utils.h"
+
+/* 1 if len bytes at p all equal byte */
+static int calloc_all(const void* p, unsigned char byte, size_t len) {
+  const unsigned char* c = (const unsigned char*)p;
+  for (size_t i = 0; i < len; i++)
+    if (c[i] != byte) return 0;
+  return 1;
+}
+
+static void test_hcalloc(void) {
+  LOG_TEST("Testing hcalloc / halloc_uninit...");
+
+  HeapErrorCode res = hinit(64 * 1024);
+  assert(res == HEAP_SUCCESS);
+  heap_set_poison(1);
+
+  /* a fresh segment is one free block that is known to be zero */
+  Header* first = heap_first_block();
+  assert(first && !IS_INUSE(first) && IS_ZERO(first));
+  printf("[PASS] Fresh segment tracked as known zero\n");
+
+  unsigned char* a = (unsigned char*)hcalloc(100, 30);
+  ASSERT_HEAP_SUCCESS(a);
+  assert(calloc_all(a, 0, 3000));
+  memset(a, 0x77, 3000);
+
+  /* freed blocks hold poison, and halloc_uninit does not clear it */
+  hfree(a);
+  unsigned char* b = (unsigned char*)halloc_uninit(3000);
+  ASSERT_HEAP_SUCCESS(b);
+  assert(b == a);
+#if HEAP_HARDENING >= HEAP_HARDEN_FULL
+  assert(calloc_all(b, 0xDE, 3000));
+#endif
+  printf("[PASS] halloc_uninit skips zeroing\n");
+
+  /* with poisoning off the old contents survive the free (bar the links) */
+  heap_set_poison(0);
+  memset(b, 0x66, 3000);
+  hfree(b);
+  unsigned char* c = (unsigned char*)halloc_uninit(3008);
+  assert(c == b);
+  assert(calloc_all(c + FREE_LINK_BYTES, 0x66, 3000 - FREE_LINK_BYTES));
+  heap_set_poison(1);
+  printf("[PASS] Poisoning can be switched off\n");
+
+  /* reused blocks are still zeroed by hcalloc and halloc */
+  memset(c, 0x55, 3008);
+  hfree(c);
+  unsigned char* d = (unsigned char*)hcalloc(1, 3016);
+  ASSERT_HEAP_SUCCESS(d);
+  assert(calloc_all(d, 0, 3016));
+
+  /* pooled blocks too */
+  unsigned char* small = (unsigned char*)halloc(40);
+  ASSERT_HEAP_SUCCESS(small);
+  memset(small, 0xAB, 40);
+  hfree(small);
+  unsigned char* zsmall = (unsigned char*)hcalloc(4, 10);
+  ASSERT_HEAP_SUCCESS(zsmall);
+  assert(calloc_all(zsmall, 0, 40));
+  printf("[PASS] Reused blocks come back zeroed\n");
+
+  assert(hcalloc(SIZE_MAX / 2, 4) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_OVERFLOW);
+
+  hfree(d);
+  hfree(zsmall);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_CALLOC_H */
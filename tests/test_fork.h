@@ -0,0 +1,128 @@
+#ifndef TEST_FORK_H
+#define TEST_FORK_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "heap.h"
+#include "heap_config.h"
+#include "heap_pool.h"
+#include "test_utils.h"
+
+#define FORK_WORKERS 4
+#define FORK_ROUNDS 50
+#define FORK_HELD 8
+#define FORK_HELD_SIZE 600
+#define FORK_REUSE_TRIES 4096
+
+#if HEAP_THREAD_SAFE
+static int _fork_stop;
+
+/* Keep every lock busy while the main thread forks */
+static void* fork_worker(void* arg) {
+  size_t salt = (size_t)(uintptr_t)arg;
+  for (size_t i = 0; !__atomic_load_n(&_fork_stop, __ATOMIC_RELAXED); i++) {
+    void* p = halloc(16 + (i * 40 + salt * 8) % 3000);
+    if (p) hfree(p);
+  }
+  return NULL;
+}
+
+/* Hold pooled blocks, owned by this thread, until told to stop */
+static void* fork_holder(void* arg) {
+  void** held = (void**)arg;
+  for (int i = 0; i < FORK_HELD; i++) held[i] = pool_alloc(FORK_HELD_SIZE);
+  __atomic_store_n(&held[FORK_HELD], (void*)1, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&_fork_stop, __ATOMIC_RELAXED)) sched_yield();
+  return NULL;
+}
+#endif
+
+static void test_fork(void) {
+  LOG_TEST("Testing usable size and fork()...");
+
+  HeapErrorCode res = hinit(256 * 1024);
+  assert(res == HEAP_SUCCESS);
+
+  /* usable size covers the request, pooled or not */
+  static const size_t sizes[] = {1, 40, 200, 1500, 3000,
+                                 HEAP_MMAP_THRESHOLD * 2};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    unsigned char* p = (unsigned char*)halloc(sizes[i]);
+    ASSERT_HEAP_SUCCESS(p);
+    size_t usable = heap_usable_size(p);
+    ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+    assert(usable >= sizes[i]);
+    memset(p, 0x5A, usable);
+    hfree(p);
+    ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  }
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  int on_stack;
+  assert(heap_usable_size(&on_stack) == 0);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+#endif
+  printf("[PASS] heap_usable_size\n");
+
+#if HEAP_THREAD_SAFE
+  /* children of a busy parent find no lock stuck */
+  pthread_t workers[FORK_WORKERS];
+  for (size_t i = 0; i < FORK_WORKERS; i++)
+    pthread_create(&workers[i], NULL, fork_worker, (void*)(uintptr_t)i);
+
+  for (int r = 0; r < FORK_ROUNDS; r++) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      void* p[64];
+      for (int i = 0; i < 64; i++) {
+        p[i] = halloc(24 + (size_t)i * 100);
+        if (!p[i]) _exit(1);
+      }
+      for (int i = 0; i < 64; i++) hfree(p[i]);
+      _exit(heap_last_error() == HEAP_SUCCESS ? 0 : 1);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  /* the child frees blocks a parent thread owned: they must come back to
+     it, not wait on the queue of a thread that does not exist there */
+  static void* held[FORK_HELD + 1];
+  pthread_t holder;
+  pthread_create(&holder, NULL, fork_holder, held);
+  while (!__atomic_load_n(&held[FORK_HELD], __ATOMIC_ACQUIRE)) sched_yield();
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    for (int i = 0; i < FORK_HELD; i++) pool_free(held[i]);
+    int found = 0;
+    for (int n = 0; n < FORK_REUSE_TRIES && found < FORK_HELD; n++) {
+      void* p = pool_alloc(FORK_HELD_SIZE);
+      for (int k = 0; k < FORK_HELD; k++)
+        if (p && p == held[k]) {
+          held[k] = NULL;
+          found++;
+        }
+    }
+    _exit(found == FORK_HELD ? 0 : 1);
+  }
+  int status;
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  printf("[PASS] A child reuses blocks freed for the parent's threads\n");
+
+  __atomic_store_n(&_fork_stop, 1, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < FORK_WORKERS; i++) pthread_join(workers[i], NULL);
+  pthread_join(holder, NULL);
+  for (int i = 0; i < FORK_HELD; i++) pool_free(held[i]);
+  printf("[PASS] fork() while other threads allocate\n");
+#endif
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_FORK_H */
@@ -6,6 +6,7 @@
 #include "heap.h"
 #include "heap_garbage.h"
 #include "heap_internal.h"
+#include "heap_pool.h"
 #include "test_utils.h"
 
 static void test_gc_short_free_and_poison(void) {
@@ -70,7 +71,44 @@ static void test_gc_short_free_and_poison(void) {
       "poisoned\n");
 }
 
+/* Heap blocks reachable only through pooled ones survive a collection */
+static void test_gc_pooled_chain(void) {
+  LOG_TEST("GC through pooled blocks: root -> pooled -> pooled -> heap");
+
+  void** root = (void**)halloc(16);
+  void** middle = (void**)halloc(40);
+  unsigned char* child = (unsigned char*)halloc(2000);
+  ASSERT_HEAP_SUCCESS(root);
+  ASSERT_HEAP_SUCCESS(middle);
+  ASSERT_HEAP_SUCCESS(child);
+  assert(pool_usable_size(root) && pool_usable_size(middle));
+  assert(!pool_usable_size(child));
+
+  /* a cycle between the pooled blocks must not recurse forever */
+  root[0] = middle;
+  middle[0] = child;
+  middle[1] = root;
+  memset(child, 0x5C, 2000);
+  gc_add_root((void**)&root);
+
+  gc_collect();
+
+  assert(root[0] == middle && middle[0] == child);
+  for (size_t i = 0; i < 2000; i++) assert(child[i] == 0x5C);
+  hfree(child);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  printf("[PASS] Heap block kept alive through pooled blocks\n");
+
+  gc_remove_root((void**)&root);
+  hfree(middle);
+  hfree(root);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+}
+
 /* Public entry point */
-void test_gc(void) { test_gc_short_free_and_poison(); }
+void test_gc(void) {
+  test_gc_short_free_and_poison();
+  test_gc_pooled_chain();
+}
 
 #endif /* TEST_GC_SHORT_H */
@@ -70,6 +70,61 @@ static void test_heap_pool(void) {
     hfree(ptr5);
   }
 
+  /* every pooled size lands in a class that wastes at most one step */
+  for (size_t size = 1; size <= 1008; size++) {
+    void* p = pool_alloc(size);
+    assert(p);
+    size_t usable = pool_usable_size(p);
+    assert(usable >= size &&
+           usable - size < HEAP_POOL_QUANTUM + (size >> HEAP_POOL_SUB_BITS));
+    assert(pool_free(p));
+  }
+  void* odd = halloc(260);
+  ASSERT_HEAP_SUCCESS(odd);
+  printf("[PASS] 260 bytes served from a %zu-byte payload\n",
+         pool_usable_size(odd));
+  hfree(odd);
+
+  /* pools grow past their first slab; sizes cycle to keep the spray check
+     quiet */
+  static unsigned char* many[3000];
+  for (int i = 0; i < 3000; i++) {
+    size_t size = 1 + (size_t)i % 40;
+    many[i] = (unsigned char*)halloc(size);
+    assert(many[i] && pool_usable_size(many[i]) >= size);
+    memset(many[i], i & 0xFF, size);
+  }
+  for (int i = 0; i < 3000; i++) assert(many[i][0] == (i & 0xFF));
+  printf("[PASS] 3000 blocks served by growing slabs\n");
+
+  pool_print_stats();
+
+  /* emptied slabs go back, all but one */
+  for (int i = 0; i < 3000; i++) {
+    assert(pool_free(many[i]));
+  }
+  assert(!pool_free(many[0]));
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+
+  /* one class over several slabs (pool_alloc skips the spray check): the
+     last blocks live in a slab that is retired once they are freed, and
+     freeing one again is still caught */
+  for (int i = 0; i < 3000; i++) {
+    many[i] = (unsigned char*)pool_alloc(20);
+    assert(many[i]);
+  }
+  for (int i = 0; i < 3000; i++) assert(pool_free(many[i]));
+  assert(!pool_free(many[2999]));
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+
+  /* inside a slab but off a block boundary */
+  unsigned char* mid = (unsigned char*)halloc(30);
+  ASSERT_HEAP_SUCCESS(mid);
+  assert(!pool_free(mid + 8));
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+  assert(pool_free(mid));
+  printf("[PASS] Double and misplaced frees rejected\n");
+
   pool_print_stats();
 
   LOG_TEST("Test completed.");
@@ -29,6 +29,7 @@ static void test_hfree(void) {
   /* view dump to see coalescing */
   DUMP_HEAP_PROMPT();
 
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
   /* double free */
   hfree(p1);
   ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
@@ -39,6 +40,7 @@ static void test_hfree(void) {
   hfree(&dummy);
   ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
   ASSERT_ERRNO(EINVAL);
+#endif
 
   hfree(p4);
 
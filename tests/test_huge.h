@@ -0,0 +1,56 @@
+#ifndef TEST_HUGE_H
+#define TEST_HUGE_H
+
+#include "heap.h"
+#include "heap_config.h"
+#include "test_utils.h"
+
+#define HUGE_BLOCKS 100
+#define HUGE_BLOCK_BYTES (100 * 1024)
+
+static void test_huge_pages(void) {
+  LOG_TEST("Testing huge page backing...");
+
+  HeapConfig cfg = {.initial_bytes = 64 * 1024, .huge_pages = 1};
+  HeapErrorCode res = hinit_config(&cfg);
+  assert(res == HEAP_SUCCESS);
+
+  /* segments come in whole huge pages, whatever the kernel grants */
+  HeapArenaStats st;
+  assert(heap_arena_stats(0, &st) == HEAP_SUCCESS);
+  assert(st.mapped_bytes % HEAP_HUGE_PAGE_BYTES == 0);
+  assert(st.hugetlb_bytes + st.thp_bytes <= st.mapped_bytes);
+  printf("[PASS] Segment of %zu bytes (hugetlb=%zu thp=%zu)\n",
+         st.mapped_bytes, st.hugetlb_bytes, st.thp_bytes);
+
+  /* growth keeps the rounding; distinct sizes keep the spray check quiet */
+  void* blocks[HUGE_BLOCKS];
+  for (int i = 0; i < HUGE_BLOCKS; i++) {
+    size_t size = HUGE_BLOCK_BYTES + (size_t)i * 64;
+    blocks[i] = halloc(size);
+    ASSERT_HEAP_SUCCESS(blocks[i]);
+    memset(blocks[i], i, size);
+  }
+  assert(heap_arena_stats(0, &st) == HEAP_SUCCESS);
+  assert(st.segments > 1);
+  assert(st.mapped_bytes % HEAP_HUGE_PAGE_BYTES == 0);
+  printf("[PASS] Grown to %zu segments, %zu bytes\n", st.segments,
+         st.mapped_bytes);
+
+  /* the scavenger only gives back whole huge pages, which only the larger
+     segments have room for inside a free block */
+  for (int i = 0; i < HUGE_BLOCKS; i++) hfree(blocks[i]);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  size_t released = heap_scavenge(0);
+  assert(released > 0);
+  assert(released % HEAP_HUGE_PAGE_BYTES == 0);
+  printf("[PASS] Scavenger released %zu bytes in huge pages\n", released);
+
+  void* again = halloc(HUGE_BLOCK_BYTES);
+  ASSERT_HEAP_SUCCESS(again);
+  hfree(again);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_HUGE_H */
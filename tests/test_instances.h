@@ -0,0 +1,109 @@
+#ifndef TEST_INSTANCES_H
+#define TEST_INSTANCES_H
+
+#include "heap.h"
+#include "heap_config.h"
+#include "heap_garbage.h"
+#include "test_utils.h"
+
+#define INSTANCE_BLOCKS 64
+
+static void test_instances(void) {
+  LOG_TEST("Testing heap instances...");
+
+  HeapErrorCode res = hinit(1024 * 1024);
+  assert(res == HEAP_SUCCESS);
+  size_t base_in_use = test_bytes_in_use();
+  size_t base_mapped = heap_total_size();
+
+  HeapConfig cfg = {.initial_bytes = 64 * 1024};
+  Heap* a = heap_create(&cfg);
+  ASSERT_HEAP_SUCCESS(a);
+  Heap* b = heap_create(&cfg);
+  ASSERT_HEAP_SUCCESS(b);
+
+  /* blocks are zeroed, owned by their instance and never by the default heap;
+     distinct sizes keep the spray check quiet */
+  void* blocks[INSTANCE_BLOCKS];
+  for (int i = 0; i < INSTANCE_BLOCKS; i++) {
+    size_t size = 2000 + (size_t)i * 48;
+    blocks[i] = heap_alloc(a, size);
+    assert(blocks[i]);
+    for (size_t j = 0; j < size; j++)
+      assert(((unsigned char*)blocks[i])[j] == 0);
+    memset(blocks[i], 0xAB, size);
+    assert(heap_owner_of(blocks[i]) == a);
+  }
+  void* other = heap_alloc(b, 3000);
+  ASSERT_HEAP_SUCCESS(other);
+  assert(heap_owner_of(other) == b);
+  assert(test_bytes_in_use() == base_in_use);
+
+  /* large blocks grow the instance instead of getting a direct mapping */
+  void* big = heap_alloc(a, HEAP_MMAP_THRESHOLD * 2);
+  ASSERT_HEAP_SUCCESS(big);
+  assert(heap_owner_of(big) == a);
+  HeapArenaStats st;
+  assert(heap_instance_stats(a, &st) == HEAP_SUCCESS);
+  assert(st.segments > 1);
+  assert(st.allocs == INSTANCE_BLOCKS + 1);
+  printf("[PASS] Instance grown to %zu segments, %zu bytes in use\n",
+         st.segments, st.bytes_in_use);
+
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  /* a block only goes back to the heap that owns it */
+  heap_free(b, blocks[0]);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+  hfree(blocks[0]);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+  heap_free(a, blocks[0]);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  heap_free(a, blocks[0]);
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+  printf("[PASS] Frees checked against the owning instance\n");
+#else
+  heap_free(a, blocks[0]);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+#endif
+  heap_free(a, big);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  /* each instance collects its own roots only */
+  void* keep = blocks[1];
+  heap_gc_add_root(a, &keep);
+  void* kept_b = other;
+  heap_gc_add_root(b, &kept_b);
+  heap_gc_collect(a);
+  assert(heap_instance_stats(a, &st) == HEAP_SUCCESS);
+  assert(st.frees == 2 + INSTANCE_BLOCKS - 2);
+  heap_free(a, keep);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  heap_gc_remove_root(a, &keep);
+  assert(heap_instance_stats(a, &st) == HEAP_SUCCESS);
+  assert(st.bytes_in_use == 0);
+  assert(heap_instance_stats(b, &st) == HEAP_SUCCESS);
+  assert(st.bytes_in_use > 0);
+  printf("[PASS] Garbage collected per instance\n");
+
+  /* destroying an instance unmaps everything it owned, live blocks too */
+  heap_destroy(a);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  heap_destroy(b);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(heap_total_size() == base_mapped);
+  assert(test_bytes_in_use() == base_in_use);
+  printf("[PASS] Destroy unmaps every segment\n");
+
+  /* NULL is the default heap */
+  void* dflt = heap_alloc(NULL, 100);
+  ASSERT_HEAP_SUCCESS(dflt);
+  assert(heap_owner_of(dflt) == NULL);
+  heap_free(NULL, dflt);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(heap_create(NULL) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_INSTANCES_H */
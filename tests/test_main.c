@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -8,6 +10,22 @@
 #include "test_heap_pool.h"
 #include "test_heap_spray.h"
 #include "test_gc.h"
+#include "test_grow.h"
+#include "test_threads.h"
+#include "test_arenas.h"
+#include "test_realloc.h"
+#include "test_mmap.h"
+#include "test_calloc.h"
+#include "test_aligned.h"
+#include "test_scavenge.h"
+#include "test_bestfit.h"
+#include "test_batch.h"
+#include "test_sized_free.h"
+#include "test_region.h"
+#include "test_fork.h"
+#include "test_huge.h"
+#include "test_instances.h"
+#include "test_stats.h"
 
 /* Test runner entry point */
 int main() {
@@ -22,6 +40,22 @@ int main() {
   printf("5. Test memory pool\n");
   printf("6. Test heap spray detection\n");
   printf("7. Test garbage collection\n");
+  printf("8. Test heap growth\n");
+  printf("9. Test multi-threaded allocation\n");
+  printf("10. Test arenas\n");
+  printf("11. Test hrealloc\n");
+  printf("12. Test direct-mmap large blocks\n");
+  printf("13. Test hcalloc / halloc_uninit\n");
+  printf("14. Test aligned allocation\n");
+  printf("15. Test page scavenger\n");
+  printf("16. Test best-fit large blocks\n");
+  printf("17. Test batch allocation and free\n");
+  printf("18. Test sized free\n");
+  printf("19. Test regions\n");
+  printf("20. Test usable size and fork\n");
+  printf("21. Test huge page backing\n");
+  printf("22. Test heap instances\n");
+  printf("23. Test statistics\n");
   printf("Enter test number to run: ");
 
   if (scanf("%d", &choice) != 1) {
@@ -52,6 +86,54 @@ int main() {
     case 7:
       test_gc();
       break;
+    case 8:
+      test_heap_growth();
+      break;
+    case 9:
+      test_threads();
+      break;
+    case 10:
+      test_arenas();
+      break;
+    case 11:
+      test_hrealloc();
+      break;
+    case 12:
+      test_direct_mmap();
+      break;
+    case 13:
+      test_hcalloc();
+      break;
+    case 14:
+      test_aligned_alloc();
+      break;
+    case 15:
+      test_scavenge();
+      break;
+    case 16:
+      test_best_fit();
+      break;
+    case 17:
+      test_batch();
+      break;
+    case 18:
+      test_sized_free();
+      break;
+    case 19:
+      test_region();
+      break;
+    case 20:
+      test_fork();
+      break;
+    case 21:
+      test_huge_pages();
+      break;
+    case 22:
+      test_instances();
+      break;
+    case 23:
+      test_stats();
+      break;
     default:
       printf("Invalid choice.\n");
       return 1;
@@ -0,0 +1,90 @@
+#ifndef TEST_MMAP_H
+#define TEST_MMAP_H
+
+#include "heap.h"
+#include "heap_garbage.h"
+#include "test_utils.h"
+
+#define MMAP_THRESHOLD (64 * 1024)
+
+/* Sum of block allocations served by the arenas */
+static size_t mmap_arena_allocs(void) {
+  HeapArenaStats st;
+  size_t allocs = 0;
+  for (unsigned a = 0; a < heap_arena_count(); a++)
+    if (heap_arena_stats(a, &st) == HEAP_SUCCESS) allocs += st.allocs;
+  return allocs;
+}
+
+static void test_direct_mmap(void) {
+  LOG_TEST("Testing direct-mmap large blocks...");
+
+  HeapConfig cfg = {.initial_bytes = 64 * 1024, .mmap_threshold = MMAP_THRESHOLD};
+  HeapErrorCode res = hinit_config(&cfg);
+  assert(res == HEAP_SUCCESS);
+
+  size_t mapped = heap_total_size();
+  size_t allocs = mmap_arena_allocs();
+
+  /* above the threshold: own mapping, the arenas are not touched */
+  unsigned char* big = (unsigned char*)halloc(200 * 1024);
+  ASSERT_HEAP_SUCCESS(big);
+  assert(mmap_arena_allocs() == allocs);
+  assert(heap_total_size() >= mapped + 200 * 1024);
+  for (size_t i = 0; i < 200 * 1024; i++) assert(big[i] == 0);
+  memset(big, 0x5A, 200 * 1024);
+  printf("[PASS] Large block mapped outside the arenas\n");
+
+  /* below the threshold: carved from an arena as before */
+  void* small = halloc(2500);
+  ASSERT_HEAP_SUCCESS(small);
+  assert(mmap_arena_allocs() == allocs + 1);
+
+  /* mremap grows and shrinks without losing data */
+  unsigned char* grown = (unsigned char*)hrealloc(big, 3 * 1024 * 1024);
+  ASSERT_HEAP_SUCCESS(grown);
+  assert(grown[0] == 0x5A && grown[200 * 1024 - 1] == 0x5A);
+  assert(grown[200 * 1024] == 0 && grown[3 * 1024 * 1024 - 1] == 0);
+  unsigned char* shrunk = (unsigned char*)hrealloc(grown, 100 * 1024);
+  ASSERT_HEAP_SUCCESS(shrunk);
+  assert(shrunk[0] == 0x5A && shrunk[100 * 1024 - 1] == 0x5A);
+  printf("[PASS] Large block resized with mremap\n");
+
+  /* traversal sees the direct block */
+  size_t live = 0;
+  for (Header* bp = heap_first_block(); bp; bp = heap_next_block(bp))
+    if (IS_INUSE(bp)) live++;
+  assert(live == 2);
+
+  /* freeing unmaps at once; the pointer is then unknown to the heap */
+  hfree(shrunk);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(heap_total_size() == mapped);
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  hfree(shrunk);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+#endif
+  printf("[PASS] Freed large block returned to the OS\n");
+
+  /* the GC keeps rooted direct blocks and unmaps the rest */
+  void* keep = halloc(100 * 1024);
+  void* drop = halloc(150 * 1024);
+  ASSERT_HEAP_SUCCESS(keep);
+  ASSERT_HEAP_SUCCESS(drop);
+  gc_add_root(&keep);
+  gc_add_root(&small);
+  gc_collect();
+  assert(heap_total_size() < mapped + 150 * 1024);
+  hfree(keep);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(heap_total_size() == mapped);
+  printf("[PASS] GC sweeps unreachable direct blocks\n");
+
+  gc_remove_root(&keep);
+  gc_remove_root(&small);
+  hfree(small);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_MMAP_H */
@@ -0,0 +1,94 @@
+#ifndef TEST_REALLOC_H
+#define TEST_REALLOC_H
+
+#include "heap.h"
+#include "heap_pool.h"
+#include "test_utils.h"
+
+/* 1 if len bytes at p all equal byte */
+static int realloc_all(const void* p, unsigned char byte, size_t len) {
+  const unsigned char* c = (const unsigned char*)p;
+  for (size_t i = 0; i < len; i++)
+    if (c[i] != byte) return 0;
+  return 1;
+}
+
+static void test_hrealloc(void) {
+  LOG_TEST("Testing hrealloc...");
+
+  HeapErrorCode res = hinit(64 * 1024);
+  assert(res == HEAP_SUCCESS);
+
+  /* shrink in place keeps the prefix and a valid post fence */
+  unsigned char* a = (unsigned char*)halloc(3000);
+  ASSERT_HEAP_SUCCESS(a);
+  memset(a, 0x11, 3000);
+  assert(hrealloc(a, 1500) == a);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(realloc_all(a, 0x11, 1500));
+  printf("[PASS] Shrink stays in place\n");
+
+  /* grow in place by absorbing the free block that follows */
+  unsigned char* b = (unsigned char*)halloc(3100);
+  unsigned char* guard = (unsigned char*)halloc(3200);
+  ASSERT_HEAP_SUCCESS(b);
+  ASSERT_HEAP_SUCCESS(guard);
+  hfree(b);
+  assert(hrealloc(a, 4000) == a);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(realloc_all(a, 0x11, 1500));
+  assert(realloc_all(a + 1504, 0, 4000 - 1504));
+  printf("[PASS] Grow absorbs the next free block, new bytes zeroed\n");
+
+  /* no room behind it: the block moves and keeps its contents; the rest of
+     its new home, dirty on purpose, reads as zero */
+  unsigned char* dirty = (unsigned char*)halloc(20000);
+  ASSERT_HEAP_SUCCESS(dirty);
+  memset(dirty, 0x44, 20000);
+  hfree(dirty);
+  memset(a, 0x22, 4000);
+  unsigned char* moved = (unsigned char*)hrealloc(a, 20000);
+  ASSERT_HEAP_SUCCESS(moved);
+  assert(moved != a);
+  assert(realloc_all(moved, 0x22, 4000));
+  assert(realloc_all(moved + 4000, 0, heap_usable_size(moved) - 4000));
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  hfree(a);
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+#endif
+  printf("[PASS] Grow without room moves the block\n");
+
+  /* pooled blocks stay put while the size fits their pool block */
+  unsigned char* small = (unsigned char*)halloc(24);
+  ASSERT_HEAP_SUCCESS(small);
+  memset(small, 0x33, 24);
+  assert(hrealloc(small, pool_usable_size(small)) == small);
+  unsigned char* big = (unsigned char*)hrealloc(small, 5000);
+  ASSERT_HEAP_SUCCESS(big);
+  assert(realloc_all(big, 0x33, 24));
+  assert(realloc_all(big + 1024, 0, heap_usable_size(big) - 1024));
+  assert(hrealloc(small, 16) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+  printf("[PASS] Pool-backed pointers resize\n");
+
+  /* NULL behaves as halloc, size 0 as hfree */
+  void* fresh = hrealloc(NULL, 700);
+  ASSERT_HEAP_SUCCESS(fresh);
+  assert(hrealloc(fresh, 0) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  int on_stack = 0;
+  assert(hrealloc(&on_stack, 64) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+#endif
+
+  hfree(moved);
+  hfree(big);
+  hfree(guard);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_REALLOC_H */
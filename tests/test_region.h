@@ -0,0 +1,75 @@
+#ifndef TEST_REGION_H
+#define TEST_REGION_H
+
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "heap.h"
+#include "heap_region.h"
+#include "test_utils.h"
+
+#define REGION_OBJECTS 2000
+
+static void test_region(void) {
+  LOG_TEST("Testing regions (harena)...");
+
+  HeapErrorCode res = hinit(1024 * 1024);
+  assert(res == HEAP_SUCCESS);
+  size_t base = test_bytes_in_use();
+
+  HeapRegion* r = harena_create(0);
+  ASSERT_HEAP_SUCCESS(r);
+
+  /* objects are aligned, zeroed and do not overlap, across many chunks */
+  static unsigned char* obj[REGION_OBJECTS];
+  for (int i = 0; i < REGION_OBJECTS; i++) {
+    size_t size = 1 + (size_t)(i * 37) % 300;
+    obj[i] = (unsigned char*)harena_alloc(r, size);
+    assert(obj[i]);
+    assert((uintptr_t)obj[i] % alignof(max_align_t) == 0);
+    for (size_t j = 0; j < size; j++) assert(obj[i][j] == 0);
+    memset(obj[i], i & 0xFF, size);
+  }
+  for (int i = 0; i < REGION_OBJECTS; i++)
+    assert(obj[i][0] == (i & 0xFF));
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  printf("[PASS] Bump allocation across chunks\n");
+
+  /* a request larger than any chunk gets a chunk of its own */
+  unsigned char* big = (unsigned char*)harena_alloc(r, 200000);
+  ASSERT_HEAP_SUCCESS(big);
+  assert(big[0] == 0 && big[199999] == 0);
+
+  /* reset reuses the same chunks: no new memory, same addresses */
+  size_t held = test_bytes_in_use();
+  size_t mapped = heap_total_size();
+  harena_reset(r);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  for (int i = 0; i < REGION_OBJECTS; i++) {
+    size_t size = 1 + (size_t)(i * 37) % 300;
+    unsigned char* p = (unsigned char*)harena_alloc(r, size);
+    assert(p == obj[i]);
+    for (size_t j = 0; j < size; j++) assert(p[j] == 0);
+  }
+  assert(harena_alloc(r, 200000) == big);
+  assert(test_bytes_in_use() == held);
+  assert(heap_total_size() == mapped);
+  printf("[PASS] Reset keeps and reuses the chunks\n");
+
+  /* errors go through the usual error state */
+  assert(harena_alloc(NULL, 8) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+  assert(harena_alloc(r, 0) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_SIZE);
+  assert(harena_alloc(r, SIZE_MAX) == NULL);
+  ASSERT_HEAP_ERROR(HEAP_OVERFLOW);
+
+  harena_destroy(r);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(test_bytes_in_use() == base);
+  printf("[PASS] Destroy returns every chunk\n");
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_REGION_H */
@@ -0,0 +1,77 @@
+#ifndef TEST_SCAVENGE_H
+#define TEST_SCAVENGE_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "heap.h"
+#include "test_utils.h"
+
+/* Resident pages among the whole pages of [ptr, ptr + bytes) */
+static size_t resident_pages(void* ptr, size_t bytes) {
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t lo = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+  uintptr_t hi = ((uintptr_t)ptr + bytes) & ~(page - 1);
+  unsigned char vec[64];
+  size_t n = (hi - lo) / page, resident = 0;
+
+  assert(n <= sizeof(vec));
+  assert(mincore((void*)lo, hi - lo, vec) == 0);
+  for (size_t i = 0; i < n; i++) resident += vec[i] & 1;
+  return resident;
+}
+
+static void test_scavenge(void) {
+  LOG_TEST("Testing the page scavenger...");
+
+  HeapErrorCode res = hinit(64 * 1024);
+  assert(res == HEAP_SUCCESS);
+  heap_set_poison(1);
+
+  /* dirty a few large blocks, then free them into one span */
+  const size_t size = 100 * 1024;
+  unsigned char* blocks[4];
+  for (int i = 0; i < 4; i++) {
+    blocks[i] = (unsigned char*)halloc_uninit(size + (size_t)i * 1024);
+    ASSERT_HEAP_SUCCESS(blocks[i]);
+    memset(blocks[i], 0x5A, size);
+  }
+  unsigned char* probe = blocks[1];
+  for (int i = 0; i < 4; i++) hfree(blocks[i]);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  assert(resident_pages(probe, size) > 0);
+
+  /* freshly freed memory is hot: a long decay keeps it */
+  assert(heap_scavenge(60 * 1000) == 0);
+  assert(resident_pages(probe, size) > 0);
+  printf("[PASS] Recently freed pages stay resident\n");
+
+  size_t released = heap_scavenge(0);
+  assert(released >= 3 * size);
+  assert(resident_pages(probe, size) == 0);
+  printf("[PASS] Scavenger released %zu bytes\n", released);
+
+  size_t total = 0;
+  HeapArenaStats st;
+  for (unsigned a = 0; a < heap_arena_count(); a++) {
+    assert(heap_arena_stats(a, &st) == HEAP_SUCCESS);
+    total += st.scavenged_bytes;
+  }
+  assert(total >= released);
+
+  /* released pages are known zero, even though they were poisoned */
+  unsigned char* again = (unsigned char*)halloc(3 * size);
+  ASSERT_HEAP_SUCCESS(again);
+  for (size_t i = 0; i < 3 * size; i++) assert(again[i] == 0);
+  printf("[PASS] Reused pages read as zero\n");
+
+  /* nothing left to release twice */
+  hfree(again);
+  heap_scavenge(0);
+  assert(heap_scavenge(0) == 0);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_SCAVENGE_H */
@@ -0,0 +1,70 @@
+#ifndef TEST_SIZED_FREE_H
+#define TEST_SIZED_FREE_H
+
+#include "heap.h"
+#include "heap_config.h"
+#include "heap_pool.h"
+#include "test_utils.h"
+
+static void test_sized_free(void) {
+  LOG_TEST("Testing hfree_sized...");
+
+  HeapErrorCode res = hinit(1024 * 1024);
+  assert(res == HEAP_SUCCESS);
+
+  /* pooled, arena and direct blocks each find their way back */
+  void* pooled = halloc(40);
+  ASSERT_HEAP_SUCCESS(pooled);
+  assert(pool_usable_size(pooled) >= 40);
+  hfree_sized(pooled, 40);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  void* again = halloc(40);
+  assert(again == pooled);
+  hfree_sized(again, 40);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  void* mid = halloc(3000);
+  ASSERT_HEAP_SUCCESS(mid);
+  hfree_sized(mid, 3000);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  void* big = halloc(HEAP_MMAP_THRESHOLD * 2);
+  ASSERT_HEAP_SUCCESS(big);
+  hfree_sized(big, HEAP_MMAP_THRESHOLD * 2);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+
+  /* size 0 falls back to the header */
+  void* unknown = halloc(500);
+  ASSERT_HEAP_SUCCESS(unknown);
+  hfree_sized(unknown, 0);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  printf("[PASS] Sized free of pooled, arena and direct blocks\n");
+
+  /* a shrunk block is freed with its new size */
+  void* shrunk = halloc(3000);
+  ASSERT_HEAP_SUCCESS(shrunk);
+  shrunk = hrealloc(shrunk, 1200);
+  ASSERT_HEAP_SUCCESS(shrunk);
+  hfree_sized(shrunk, 1200);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  printf("[PASS] Sized free after hrealloc\n");
+
+#if HEAP_HARDENING >= HEAP_HARDEN_CHEAP
+  /* sizes the header cannot have come from are refused, block kept */
+  void* b = halloc(3000);
+  ASSERT_HEAP_SUCCESS(b);
+  hfree_sized(b, 5000);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_SIZE);
+  hfree_sized(b, 100);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_SIZE);
+  hfree_sized(b, 2990);
+  ASSERT_HEAP_ERROR(HEAP_SUCCESS);
+  hfree_sized(b, 2990);
+  ASSERT_HEAP_ERROR(HEAP_DOUBLE_FREE);
+  printf("[PASS] Size cross-checked against the header\n");
+#endif
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_SIZED_FREE_H */
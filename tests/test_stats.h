@@ -0,0 +1,125 @@
+#ifndef TEST_STATS_H
+#define TEST_STATS_H
+
+#include "heap.h"
+#include "heap_config.h"
+#include "heap_pool.h"
+#include "test_utils.h"
+
+#define STATS_BLOCKS 32
+#define STATS_POOLED 100
+
+/* The incremental counters must match what a full walk of the heap finds */
+static void stats_check_walk(const HeapStats* st) {
+  size_t free_bytes = 0, free_blocks = 0, largest = 0;
+
+  heap_lock();
+  for (Header* bp = heap_first_block(); bp; bp = heap_next_block(bp)) {
+    if (IS_INUSE(bp)) continue;
+    free_bytes += BLOCK_BYTES(bp);
+    free_blocks++;
+    if (BLOCK_BYTES(bp) > largest) largest = BLOCK_BYTES(bp);
+  }
+  heap_unlock();
+
+  assert(st->free_bytes == free_bytes);
+  assert(st->free_blocks == free_blocks);
+  assert(st->largest_free == largest);
+}
+
+static void test_stats(void) {
+  LOG_TEST("Testing statistics...");
+
+  HeapErrorCode res = hinit(1024 * 1024);
+  assert(res == HEAP_SUCCESS);
+  assert(heap_get_stats(NULL) == HEAP_INVALID_POINTER);
+  assert(pool_get_stats(NULL) == HEAP_INVALID_POINTER);
+
+  HeapStats before;
+  assert(heap_get_stats(&before) == HEAP_SUCCESS);
+  stats_check_walk(&before);
+  assert(before.free_blocks > 0 && before.largest_free <= before.free_bytes);
+  assert(before.peak_in_use >= before.bytes_in_use);
+
+  /* every other block freed: holes that cannot merge; distinct sizes keep
+     the spray check quiet */
+  void* blocks[STATS_BLOCKS];
+  for (int i = 0; i < STATS_BLOCKS; i++) {
+    blocks[i] = halloc(3000 + (size_t)i * 16);
+    assert(blocks[i]);
+  }
+  for (int i = 0; i < STATS_BLOCKS; i += 2) hfree(blocks[i]);
+
+  HeapStats st;
+  assert(heap_get_stats(&st) == HEAP_SUCCESS);
+  stats_check_walk(&st);
+  assert(st.allocs == before.allocs + STATS_BLOCKS);
+  assert(st.frees == before.frees + STATS_BLOCKS / 2);
+  assert(st.bytes_in_use >= before.bytes_in_use + STATS_BLOCKS / 2 * 3000);
+  assert(st.peak_in_use >= before.bytes_in_use + STATS_BLOCKS * 3000);
+  assert(st.fragmentation > before.fragmentation && st.fragmentation < 1.0);
+  printf("[PASS] %zu free blocks, %zu bytes, largest %zu, "
+         "fragmentation %.3f\n",
+         st.free_blocks, st.free_bytes, st.largest_free, st.fragmentation);
+
+  for (int i = 1; i < STATS_BLOCKS; i += 2) hfree(blocks[i]);
+  assert(heap_get_stats(&st) == HEAP_SUCCESS);
+  stats_check_walk(&st);
+  assert(st.bytes_in_use == before.bytes_in_use);
+  assert(st.peak_in_use >= before.bytes_in_use + STATS_BLOCKS * 3000);
+  printf("[PASS] Counters back to the start, peak %zu kept\n",
+         st.peak_in_use);
+
+  /* direct mappings are counted apart from the arenas */
+  void* big = halloc(HEAP_MMAP_THRESHOLD * 2);
+  ASSERT_HEAP_SUCCESS(big);
+  assert(heap_get_stats(&st) == HEAP_SUCCESS);
+  assert(st.direct_blocks == before.direct_blocks + 1);
+  assert(st.direct_bytes >= before.direct_bytes + HEAP_MMAP_THRESHOLD * 2);
+  hfree(big);
+  assert(heap_get_stats(&st) == HEAP_SUCCESS);
+  assert(st.direct_blocks == before.direct_blocks);
+  assert(st.direct_bytes == before.direct_bytes);
+  printf("[PASS] Direct blocks counted\n");
+
+  /* pools: per-class counters move with pool_alloc and pool_free */
+  PoolStats p0, p1;
+  assert(pool_get_stats(&p0) == HEAP_SUCCESS);
+  void* pooled[STATS_POOLED];
+  for (int i = 0; i < STATS_POOLED; i++) {
+    pooled[i] = pool_alloc(40);
+    assert(pooled[i]);
+  }
+  assert(pool_get_stats(&p1) == HEAP_SUCCESS);
+
+  int cls = -1;
+  for (int i = 0; i < NUM_POOLS; i++)
+    if (p1.classes[i].alloc_requests != p0.classes[i].alloc_requests) {
+      assert(cls < 0);
+      cls = i;
+    }
+  assert(cls >= 0);
+  const PoolClassStats* c0 = &p0.classes[cls];
+  const PoolClassStats* c1 = &p1.classes[cls];
+  assert(c1->block_size >= 40);
+  assert(c1->alloc_requests == c0->alloc_requests + STATS_POOLED);
+  assert(c1->used_blocks == c0->used_blocks + STATS_POOLED);
+  assert(c1->peak_used >= c1->used_blocks);
+  assert(c1->requested_bytes == c0->requested_bytes + STATS_POOLED * 40);
+  assert(c1->total_blocks >= c1->used_blocks && c1->slabs > 0);
+  assert(p1.used_bytes >= p0.used_bytes + STATS_POOLED * c1->block_size);
+  assert(p1.mapped_bytes >= p1.used_bytes + p1.free_bytes);
+  assert(p1.fragmentation > 0.0 && p1.fragmentation < 1.0);
+
+  for (int i = 0; i < STATS_POOLED; i++) assert(pool_free(pooled[i]));
+  assert(pool_get_stats(&p1) == HEAP_SUCCESS);
+  assert(p1.classes[cls].used_blocks == c0->used_blocks);
+  assert(p1.classes[cls].free_requests == c0->free_requests + STATS_POOLED);
+  printf("[PASS] Pool class %d (%zu bytes): peak %zu, fragmentation %.3f\n",
+         cls, p1.classes[cls].block_size, p1.classes[cls].peak_used,
+         p1.fragmentation);
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_STATS_H */
@@ -0,0 +1,222 @@
+#ifndef TEST_THREADS_H
+#define TEST_THREADS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "heap.h"
+#include "heap_pool.h"
+#include "test_utils.h"
+
+#define THREADS_COUNT 4
+#define THREADS_ITERS 20000
+#define THREADS_LIVE 32
+#define THREADS_POOL_LIVE 1500  /* past a slab's worth: the free stack spills */
+#define THREADS_CACHED_SIZE 1500  /* past the pools, in a thread cache class */
+
+typedef struct {
+  int id;
+  int corrupted;        /* pattern mismatches seen */
+  int failed;           /* allocations that returned NULL */
+  HeapErrorCode first;  /* heap_last_error() on thread start */
+} thread_result;
+
+/* Allocate, fill, verify and free random-sized blocks */
+static void* threads_worker(void* arg) {
+  thread_result* res = (thread_result*)arg;
+  unsigned char* live[THREADS_LIVE] = {0};
+  size_t sizes[THREADS_LIVE] = {0};
+  uint32_t seed = 0x9E3779B9u * (uint32_t)(res->id + 1);
+
+  res->first = heap_last_error();
+
+  for (int i = 0; i < THREADS_ITERS; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int slot = (int)(seed % THREADS_LIVE);
+    if (live[slot]) {
+      for (size_t j = 0; j < sizes[slot]; j++)
+        if (live[slot][j] != (unsigned char)res->id) {
+          res->corrupted++;
+          break;
+        }
+      hfree(live[slot]);
+    }
+
+    sizes[slot] = 1 + (seed >> 8) % 2000;
+    live[slot] = (unsigned char*)halloc(sizes[slot]);
+    if (!live[slot]) {
+      res->failed++;
+      continue;
+    }
+    memset(live[slot], res->id, sizes[slot]);
+  }
+
+  for (int s = 0; s < THREADS_LIVE; s++)
+    if (live[s]) hfree(live[s]);
+  return NULL;
+}
+
+/* Every thread works one pool class, its blocks cycling through the stack */
+static void* threads_pool_worker(void* arg) {
+  thread_result* res = (thread_result*)arg;
+  static _Thread_local unsigned char* live[THREADS_POOL_LIVE];
+
+  for (int round = 0; round < 8; round++) {
+    for (int i = 0; i < THREADS_POOL_LIVE; i++) {
+      live[i] = (unsigned char*)pool_alloc(40);
+      if (!live[i]) {
+        res->failed++;
+        continue;
+      }
+      memset(live[i], res->id, 40);
+    }
+    for (int i = 0; i < THREADS_POOL_LIVE; i++) {
+      if (!live[i]) continue;
+      for (size_t j = 0; j < 40; j++)
+        if (live[i][j] != (unsigned char)res->id) {
+          res->corrupted++;
+          break;
+        }
+      if (!pool_free(live[i])) res->failed++;
+    }
+  }
+  return NULL;
+}
+
+#define THREADS_HANDOFF 100
+
+/* Free another thread's blocks: they go to its remote-free queue */
+static void* threads_consumer(void* arg) {
+  void** blocks = (void**)arg;
+  for (int i = 0; i < THREADS_HANDOFF; i++)
+    if (!pool_free(blocks[i])) return (void*)1;
+  return NULL;
+}
+
+/* Hand blocks to a consumer, then get the very same blocks back */
+static void* threads_producer(void* arg) {
+  thread_result* res = (thread_result*)arg;
+  void* sent[THREADS_HANDOFF];
+  for (int i = 0; i < THREADS_HANDOFF; i++) {
+    sent[i] = pool_alloc(40);
+    if (!sent[i]) res->failed++;
+  }
+
+  pthread_t consumer;
+  void* ret;
+  pthread_create(&consumer, NULL, threads_consumer, sent);
+  pthread_join(consumer, &ret);
+  if (ret) res->failed++;
+
+  for (int i = 0; i < THREADS_HANDOFF; i++) {
+    void* back = pool_alloc(40);
+    int known = 0;
+    for (int j = 0; j < THREADS_HANDOFF; j++) known |= back == sent[j];
+    if (!known) res->corrupted++;
+    pool_free(back);
+  }
+  return NULL;
+}
+
+#if HEAP_THREAD_SAFE
+/* A fresh thread's cache: one miss refills it, then hits take no arena lock */
+static void* threads_cache_worker(void* arg) {
+  thread_result* res = (thread_result*)arg;
+  HeapStats before, after;
+
+  void* first = halloc(THREADS_CACHED_SIZE);
+  if (!first) res->failed++;
+  assert(heap_get_stats(&before) == HEAP_SUCCESS);
+
+  /* same block size, distinct request sizes for the spray check */
+  void* hit = halloc(THREADS_CACHED_SIZE + 1);
+  if (!hit) res->failed++;
+  hfree(hit);
+  void* again = halloc(THREADS_CACHED_SIZE + 2);
+  if (again != hit) res->corrupted++;
+
+  /* the hits and the free stayed in the cache: the arenas saw nothing */
+  assert(heap_get_stats(&after) == HEAP_SUCCESS);
+  if (after.allocs != before.allocs || after.frees != before.frees)
+    res->corrupted++;
+
+  hfree(again);
+  hfree(first);
+  return NULL;
+}
+#endif
+
+static void test_threads(void) {
+  LOG_TEST("Testing concurrent halloc/hfree...");
+
+  HeapErrorCode res = hinit(64 * 1024);
+  assert(res == HEAP_SUCCESS);
+
+  /* an error in this thread must not be visible to the workers */
+  hfree(NULL);
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+
+  pthread_t threads[THREADS_COUNT];
+  thread_result results[THREADS_COUNT];
+
+  for (int i = 0; i < THREADS_COUNT; i++) {
+    results[i] = (thread_result){.id = i + 1};
+    pthread_create(&threads[i], NULL, threads_worker, &results[i]);
+  }
+  for (int i = 0; i < THREADS_COUNT; i++) pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < THREADS_COUNT; i++) {
+    assert(results[i].first == HEAP_SUCCESS);
+    assert(results[i].corrupted == 0);
+    assert(results[i].failed == 0);
+  }
+  printf("[PASS] %d threads x %d ops: no corruption, no failures\n",
+         THREADS_COUNT, THREADS_ITERS);
+
+  /* the lock-free pool paths under the same load */
+  for (int i = 0; i < THREADS_COUNT; i++) {
+    results[i] = (thread_result){.id = i + 1};
+    pthread_create(&threads[i], NULL, threads_pool_worker, &results[i]);
+  }
+  for (int i = 0; i < THREADS_COUNT; i++) pthread_join(threads[i], NULL);
+  for (int i = 0; i < THREADS_COUNT; i++) {
+    assert(results[i].corrupted == 0);
+    assert(results[i].failed == 0);
+  }
+  printf("[PASS] %d threads sharing one pool class\n", THREADS_COUNT);
+
+  /* cross-thread frees come back to the allocating thread */
+  thread_result handoff = {.id = 1};
+  pthread_t producer;
+  pthread_create(&producer, NULL, threads_producer, &handoff);
+  pthread_join(producer, NULL);
+  assert(handoff.failed == 0);
+  assert(handoff.corrupted == 0);
+  printf("[PASS] Remote frees drained by the allocating thread\n");
+
+#if HEAP_THREAD_SAFE
+  thread_result cache = {.id = 1};
+  pthread_t cacher;
+  pthread_create(&cacher, NULL, threads_cache_worker, &cache);
+  pthread_join(cacher, NULL);
+  assert(cache.failed == 0);
+  assert(cache.corrupted == 0);
+  printf("[PASS] Thread cache hits served without the arena\n");
+#endif
+
+  ASSERT_HEAP_ERROR(HEAP_INVALID_POINTER);
+
+  /* every worker flushed its cache on exit: no block is left in use */
+  size_t live = 0;
+  for (Header* bp = heap_first_block(); bp; bp = heap_next_block(bp))
+    if (IS_INUSE(bp)) live++;
+  assert(live == 0);
+  printf("[PASS] Thread caches flushed on exit\n");
+
+  DUMP_HEAP_PROMPT();
+}
+
+#endif /* TEST_THREADS_H */
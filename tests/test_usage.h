@@ -34,12 +34,14 @@ static void test_simple_usage(void) {
   printf("Freed the array...\n");
   DUMP_HEAP_PROMPT();
 
+#if HEAP_HARDENING >= HEAP_HARDEN_FULL
   /* Fence corruption test */
   char* corrupt = (char*)halloc(1600);
   corrupt[-1] ^= 0xFF;  /* Corrupt pre-fence */
   hfree(corrupt);
   ASSERT_HEAP_ERROR(HEAP_BOUNDARY_ERROR);
   ASSERT_ERRNO(EFAULT);
+#endif
 }
 
 #endif
@@ -60,6 +60,15 @@
     }                                                                        \
   } while (0)
 
+/* Block bytes held by callers across all arenas */
+static inline size_t test_bytes_in_use(void) {
+  HeapArenaStats st;
+  size_t bytes = 0;
+  for (unsigned a = 0; a < heap_arena_count(); a++)
+    if (heap_arena_stats(a, &st) == HEAP_SUCCESS) bytes += st.bytes_in_use;
+  return bytes;
+}
+
 /* Prompt user to dump heap */
 #define DUMP_HEAP_PROMPT()                              \
   do {                                                  \